@@ -9,6 +9,7 @@
 #include <addrspace.h>
 #include <curthread.h>
 #include <syscall.h>
+#include <proc.h>
 
 
 /*
@@ -51,6 +52,9 @@
 void
 mips_syscall(struct trapframe *tf)
 {
+	struct syscall_desc *sd;
+	time_t secs;
+	u_int32_t nsecs;
 	int callno;
 	int32_t retval;
 	int err;
@@ -70,98 +74,34 @@ mips_syscall(struct trapframe *tf)
 
 	retval = 0;
 
-	switch (callno) {
-	    case SYS_reboot:
-		err = sys_reboot(tf->tf_a0);
-		break;
-
-	    case SYS__exit:
-		err = sys__exit(tf->tf_a0);
-		break;
-	    /* Add stuff here */
-
-	    case SYS_execv:
-		retval = sys_execv(tf->tf_a0, tf->tf_a1);
-		if (retval < 0)
-			err = -retval;
-		else
-			err = 0;
-		break;
- 
-	    case SYS_fork:
-		retval = sys_fork(tf);
-		if (retval < 0)
-			err = -retval;
-		else
-			err = 0;
-		break;
-
-	    case SYS_waitpid:
-		retval = sys_waitpid((pid_t) tf->tf_a0, (int *) tf->tf_a1, 
-				(int) tf->tf_a2);
-		if (retval < 0)
-			err = -retval;
-		else
-			err = 0;
-		break;
-
-	    case SYS_open:
-		retval = sys_open((char *) tf->tf_a0, (int) tf->tf_a1);
-		if (retval < 0)
-			err = -retval;
-		else
-			err = 0;
-		break;
-
-	    case SYS_write:
-		retval = sys_write((int) tf->tf_a0, (const void *) tf->tf_a1,
-				(size_t) tf->tf_a2);
-		if (retval < 0)
-			err = -retval;
-		else
-			err = 0;
-		break;
+	/*
+	 * Look the call up in the system call table (see syscall.h)
+	 * and let its wrapper pick the arguments out of the trapframe.
+	 */
+	sd = syscall_lookup(callno);
+	if (sd == NULL) {
+		kprintf("Unknown syscall %d\n", callno);
+		err = ENOSYS;
+	}
+	else {
+		syscall_enter(sd, &secs, &nsecs);
 
-            case SYS_read:
-		retval = sys_read((int) tf->tf_a0, (void *) tf->tf_a1,
-				(size_t) tf->tf_a2);
-		if (retval < 0)
-			err = -retval;
-		else
-			err = 0;
-		break;
+		retval = sd->sd_func(tf);
 
-	    case SYS_close:
-		retval = sys_close((int) tf->tf_a0);
-		if (retval < 0)
+		if (sd->sd_conv == SC_ERRNO) {
+			err = retval;
+			retval = 0;
+		}
+		else if (retval < 0) {
 			err = -retval;
-		else
+		}
+		else {
 			err = 0;
-		break;
+		}
 
-	    case SYS_fstat:
-		err = sys_fstat((int) tf->tf_a0, (struct stat *) tf->tf_a1);
-		break;
-
-	    case SYS_lseek:
-		retval = sys_lseek((int) tf->tf_a0, (off_t) tf->tf_a1, 
-				(int) tf->tf_a2);
-		if (retval < 0)
-			err = -retval;
-		else
-			err = 0;
-		break;
-	
-	    case SYS_mprotect:
-		err = sys_mprotect((vaddr_t) tf->tf_a0, (size_t) tf->tf_a1, 
-				(int) tf->tf_a2);
-	    default:
-		kprintf("Unknown syscall %d\n", callno);
-		err = ENOSYS;
-		break;
+		syscall_leave(sd, err, secs, nsecs);
 	}
 
-
 	if (err) {
 		/*
 		 * Return the error code. This gets converted at
@@ -203,6 +143,7 @@ md_forkentry(u_int32_t *args)
 	
 	curthread->t_vmspace = argas;
 	curthread->t_pid = argpid;
+	curthread->t_proc = getprocess(argpid);
 
 	childtf.tf_epc += 4; /* jump past the fork */
 	childtf.tf_v0 = 0; /* pass the child 0 */
@@ -3,7 +3,8 @@
 #include <kern/errno.h>
 #include <kern/unistd.h>
 #include <kern/stat.h>
-#include <array.h>
+#include <bitmap.h>
+#include <kmem.h>
 #include <synch.h>
 #include <vnode.h>
 #include <vfs.h>
@@ -12,94 +13,94 @@
 #include <file.h>
 #include <proc.h>
 
+/* sys_filemappings come from their own object cache */
+static struct kmem_cache *filemapping_cache;
+
 void
 file_bootstrap()
 {
-	struct array *ft;
-	struct process *proc;
+	struct fdtable *ft;
+	struct sys_filemapping *fm;
 	int result;
 
-	filetable = array_create();
-	if (filetable==NULL)
-		panic("file_bootstrap: could not allocate filetable\n");
+	filemapping_lock = lock_create("filemapping_lock");
+	if (filemapping_lock==NULL)
+		panic("file_bootstrap: could not allocate filemapping_lock\n");
 
-	filetable_lock = lock_create("filetable_lock");
-	if (filetable_lock==NULL)
-		panic("file_bootstrap: could not allocate filetable_lock\n");
+	filemapping_cache = kmem_cache_create("sys_filemapping",
+			sizeof(struct sys_filemapping), NULL);
+	if (filemapping_cache==NULL)
+		panic("file_bootstrap: could not create filemapping cache\n");
 
-	/* TODO add filedescriptors for console to table */
-	
 	/* set up filetable for origin thread */
-	proc = getcurprocess();
-	ft = array_create();
+	ft = filetable_create();
 	if (ft==NULL)
 		panic("file_bootstrap: could not allocate origin thread's filetable\n");
 
 	setfiletable(curthread->t_pid, ft);
 
 	result = sys_open("con:", O_RDWR); // stdin
-	addprocfilemapping(result, curthread->t_pid); // stdout
-	addprocfilemapping(result, curthread->t_pid); // stderr
+	if (result < 0)
+		panic("file_bootstrap: could not open console: %s\n",
+				strerror(-result));
+
+	fm = resolvefd(result);
+	filemapping_incref(fm);
+	addprocfilemapping(fm); // stdout
+	filemapping_incref(fm);
+	addprocfilemapping(fm); // stderr
 }
 
 void
-filetable_dump(struct array *ft)
+filetable_dump(struct fdtable *ft)
 {
-	struct process *proc;
-	int i, num;
-	proc_filemapping *mpg;
+	int i;
 
-	num = array_getnum(ft);
-	for (i=0; i<num; i++)
+	for (i=0; i<OPEN_MAX; i++)
 	{
-		mpg = (proc_filemapping *) array_getguy(ft, i);
-		kprintf("%d -> %d\n", i, *mpg);
+		if (ft->files[i] != NULL)
+			kprintf("%d -> %p\n", i, ft->files[i]);
 	}
 }
 
 struct sys_filemapping *
 resolvefd(int fd)
 {
-	struct process *proc;
-	struct sys_filemapping *fm;
-	int sys_index;
+	struct fdtable *ft;
 
-	proc = getcurprocess();
+	ft = curthread->t_proc->filetable;
 
-	lock_acquire(proctable_lock);
-	if ((fd >= array_getnum(proc->filetable)) || (fd < 0))
-	{
-		lock_release(proctable_lock);
+	if ((fd < 0) || (fd >= OPEN_MAX) || (ft==NULL))
 		return NULL;
-	}
-
-	sys_index = *((int *) array_getguy(proc->filetable, fd));
-	lock_release(proctable_lock);
-
-	lock_acquire(filetable_lock);
-	if (sys_index >= array_getnum(filetable))
-		panic("resolvefd: process contains stale or invalid sys_fd\n");
-	if (sys_index < 0)
-		panic("resolvefd: process contains negative sys_fd\n");
 
-	fm = (struct sys_filemapping *) array_getguy(filetable, sys_index);
-	lock_release(filetable_lock);
-
-	return fm;
+	return ft->files[fd];
 }
 
 int
-newfilemapping(struct vnode *v, int flags)
+newfilemapping(struct vnode *v, int flags, struct sys_filemapping **ret)
 {
-	int fd;
 	struct sys_filemapping *fm;
 	struct stat st;
 	int result;
 
-	fm = (struct sys_filemapping *) kmalloc(sizeof(struct sys_filemapping));
+	fm = (struct sys_filemapping *) kmem_cache_alloc(filemapping_cache);
 	if (fm==NULL)
 		return -ENOMEM;
 
+	/* devices that can't seek have no offset to keep straight. The
+	 * console mapping is shared by stdin and stdout, and a read waiting
+	 * on the keyboard mustn't hold up writes */
+	fm->offlock = NULL;
+	if (VOP_TRYSEEK(v, 0) != ESPIPE)
+	{
+		fm->offlock = lock_create("offlock");
+		if (fm->offlock==NULL)
+		{
+			kmem_cache_free(filemapping_cache, fm);
+			return -ENOMEM;
+		}
+	}
+
 	fm->vn = v;
 	fm->offset = 0;
 	fm->flags = flags;
@@ -110,57 +111,153 @@ newfilemapping(struct vnode *v, int flags)
 		result = VOP_STAT(v, &st);
 		if (result)
 		{
-			kfree(fm);
+			if (fm->offlock != NULL)
+				lock_destroy(fm->offlock);
+			kmem_cache_free(filemapping_cache, fm);
 			return -result;
 		}
 		fm->offset = st.st_size;
 	}
 
-	fd = findfreedescriptor();
-	lock_acquire(filetable_lock);
-	if (fd == array_getnum(filetable))
+	*ret = fm;
+	return 0;
+}
+
+void
+filemapping_incref(struct sys_filemapping *fm)
+{
+	lock_acquire(filemapping_lock);
+	assert(fm->refcnt > 0);
+	fm->refcnt++;
+	lock_release(filemapping_lock);
+}
+
+void
+filemapping_decref(struct sys_filemapping *fm)
+{
+	u_int32_t refcnt;
+
+	lock_acquire(filemapping_lock);
+	assert(fm->refcnt > 0);
+	refcnt = --fm->refcnt;
+	lock_release(filemapping_lock);
+
+	if (refcnt > 0)
+		return;
+
+	/* no more references to mapping */
+	vfs_close(fm->vn);
+	if (fm->offlock != NULL)
+		lock_destroy(fm->offlock);
+	kmem_cache_free(filemapping_cache, fm);
+}
+
+void
+filemapping_lockoffset(struct sys_filemapping *fm)
+{
+	if (fm->offlock != NULL)
+		lock_acquire(fm->offlock);
+}
+
+void
+filemapping_unlockoffset(struct sys_filemapping *fm)
+{
+	if (fm->offlock != NULL)
+		lock_release(fm->offlock);
+}
+
+void
+filemapping_setoffset(struct sys_filemapping *fm, off_t offset)
+{
+	if (fm->offlock==NULL)
+		return;
+
+	assert(lock_do_i_hold(fm->offlock));
+	fm->offset = offset;
+}
+
+int
+addprocfilemapping(struct sys_filemapping *fm)
+{
+	struct fdtable *ft;
+	u_int32_t fd;
+
+	ft = curthread->t_proc->filetable;
+
+	if (bitmap_alloc(ft->used, &fd))
 	{
-		array_add(filetable, fm);
-	} else {
-		array_setguy(filetable, fd, fm);
+		filemapping_decref(fm);
+		return -EMFILE;
 	}
-	lock_release(filetable_lock);
+
+	assert(ft->files[fd]==NULL);
+	ft->files[fd] = fm;
 
 	return fd;
 }
 
 int
-addprocfilemapping(int fd, pid_t pid)
+closeprocfilemapping(int fd)
 {
-	int retfd;
-	struct process *proc;
-	proc_filemapping *newind;
-	
-	proc = getprocess(pid);
-	lock_acquire(proctable_lock);
-	if (proc==NULL)
+	struct fdtable *ft;
+	struct sys_filemapping *fm;
+
+	ft = curthread->t_proc->filetable;
+
+	if ((fd < 0) || (fd >= OPEN_MAX) || (ft==NULL))
+		return -EBADF;
+
+	fm = ft->files[fd];
+	if (fm==NULL)
+		return -EBADF;
+
+	ft->files[fd] = NULL;
+	bitmap_unmark(ft->used, fd);
+
+	filemapping_decref(fm);
+	return 0;
+}
+
+struct fdtable *
+filetable_create(void)
+{
+	struct fdtable *ft;
+	int i;
+
+	ft = (struct fdtable *) kmalloc(sizeof(struct fdtable));
+	if (ft==NULL)
+		return NULL;
+
+	ft->used = bitmap_create(OPEN_MAX);
+	if (ft->used==NULL)
 	{
-		lock_release(proctable_lock);
-		return -1;
+		kfree(ft);
+		return NULL;
 	}
-	
-	newind = (proc_filemapping *) kmalloc(sizeof(proc_filemapping));
-	if (newind==NULL)
+
+	for (i=0; i<OPEN_MAX; i++)
+		ft->files[i] = NULL;
+
+	return ft;
+}
+
+void
+filetable_destroy(struct fdtable *ft)
+{
+	int i;
+
+	for (i=0; i<OPEN_MAX; i++)
 	{
-		lock_release(proctable_lock);
-		return -ENOMEM;
+		if (ft->files[i] != NULL)
+			filemapping_decref(ft->files[i]);
 	}
-	*newind = fd;
-
-	retfd = array_getnum(proc->filetable);
-	array_add(proc->filetable, newind);
-	lock_release(proctable_lock);
 
-	return retfd;
+	bitmap_destroy(ft->used);
+	kfree(ft);
 }
 
 int
-setfiletable(pid_t pid, struct array *ft)
+setfiletable(pid_t pid, struct fdtable *ft)
 {
 	struct process *proc;
 
@@ -168,101 +265,40 @@ setfiletable(pid_t pid, struct array *ft)
 	if (proc==NULL)
 		return -1;
 
-	lock_acquire(proctable_lock);
 	proc->filetable = ft;
-	lock_release(proctable_lock);
 
 	return 0;
 }
 
-struct array *
+struct fdtable *
 copyfiletable(pid_t pid)
 {
 	struct process *proc;
-	struct array *ft;
-	struct array *newft;
-	proc_filemapping *ind;
-	proc_filemapping *newind;
-	int i, num;
+	struct fdtable *ft;
+	struct fdtable *newft;
+	int i;
 
 	proc = getprocess(pid);
 	if (proc==NULL)
 		return NULL;
 	
-	lock_acquire(proctable_lock);
 	ft = proc->filetable;
-
 	if (ft==NULL)
-	{
-		lock_release(proctable_lock);
 		return NULL;
-	}
 
-	newft = array_create();	
+	newft = filetable_create();	
 	if (newft==NULL)
-	{
-		lock_release(proctable_lock);
 		return NULL;
-	}
 
-	num = array_getnum(ft);
-	for (i=0; i<num; i++)
+	for (i=0; i<OPEN_MAX; i++)
 	{
-		ind = (proc_filemapping *) array_getguy(ft, i);
-		if (ind==NULL)
-		{
-			newind = NULL;
-		}
-		else
-		{
-			newind = (proc_filemapping *) kmalloc(sizeof(proc_filemapping));
-			if (newind==NULL)
-				panic("[copyfiletable] out of memory\n");
-			*newind = *ind;
-		}
-		array_add(newft, newind);
-	}
-	lock_release(proctable_lock);
+		if (ft->files[i]==NULL)
+			continue;
 
-	incrementrefs(newft);
-	return newft;
-}
-
-void
-incrementrefs(struct array *ft)
-{
-	int i, num;
-	proc_filemapping *pmpg;
-	struct sys_filemapping *smpg;
-
-	lock_acquire(filetable_lock);
-
-	num = array_getnum(ft);
-	for(i=0; i<num; i++)
-	{
-		pmpg = (proc_filemapping *) array_getguy(ft, i);
-		smpg = (struct sys_filemapping *) array_getguy(filetable, *pmpg);
-		assert(smpg!=NULL); /* no processes should ever hold a stale ref */
-		smpg->refcnt++;
+		filemapping_incref(ft->files[i]);
+		newft->files[i] = ft->files[i];
+		bitmap_mark(newft->used, i);
 	}
 
-	lock_release(filetable_lock);
-
-}
-
-int
-findfreedescriptor()
-{
-	int i, count;
-	
-	lock_acquire(filetable_lock);
-	count = array_getnum(filetable);
-	for (i=0; i < count; i++)
-	{
-		if (array_getguy(filetable, i)==NULL)
-			break;
-	}
-
-	lock_release(filetable_lock);
-	return i;
+	return newft;
 }
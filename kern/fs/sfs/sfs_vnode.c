@@ -5,6 +5,8 @@
  */
 #include <types.h>
 #include <lib.h>
+#include <machine/spl.h>
+#include <kmem.h>
 #include <synch.h>
 #include <array.h>
 #include <bitmap.h>
@@ -15,6 +17,9 @@
 #include <dev.h>
 #include <sfs.h>
 
+/* Cache for struct sfs_vnode, shared by all mounts; made on first use */
+static struct kmem_cache *sfs_vnode_cache;
+
 /* At bottom of file */
 static int 
 sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int type,
@@ -917,7 +922,7 @@ sfs_reclaim(struct vnode *v)
 	VOP_KILL(&sv->sv_v);
 
 	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
+	kmem_cache_free(sfs_vnode_cache, sv);
 
 	/* Done */
 	return 0;
@@ -1551,6 +1556,7 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 	const struct vnode_ops *ops = NULL;
 	int i, num;
 	int result;
+	int spl;
 
 	/* Look in the vnodes table */
 	num = array_getnum(sfs->sfs_vnodes);
@@ -1579,7 +1585,18 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 
 	/* Didn't have it loaded; load it */
 
-	sv = kmalloc(sizeof(struct sfs_vnode));
+	spl = splhigh();
+	if (sfs_vnode_cache==NULL) {
+		sfs_vnode_cache = kmem_cache_create("sfs_vnode",
+						    sizeof(struct sfs_vnode),
+						    NULL);
+	}
+	splx(spl);
+	if (sfs_vnode_cache==NULL) {
+		return ENOMEM;
+	}
+
+	sv = kmem_cache_alloc(sfs_vnode_cache);
 	if (sv==NULL) {
 		return ENOMEM;
 	}
@@ -1593,7 +1610,7 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 	/* Read the block the inode is in */
 	result = sfs_rblock(sfs, &sv->sv_i, ino);
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -1630,7 +1647,7 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = VOP_INIT(&sv->sv_v, ops, &sfs->sfs_absfs, sv);
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -1641,7 +1658,7 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 	result = array_add(sfs->sfs_vnodes, sv);
 	if (result) {
 		VOP_KILL(&sv->sv_v);
-		kfree(sv);
+		kmem_cache_free(sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -76,6 +76,10 @@ struct page
  *    as_destroy - dispose of an address space. You may need to change
  *                the way this works if implementing user-level threads.
  *
+ *    as_discard - dispose of an address space made by as_copy for PID
+ *                that never ran, from outside PID. Releases the
+ *                frames and swap charged to PID.
+ *
  *    as_define_region - set up a region of memory within the address
  *                space.
  *
@@ -94,6 +98,7 @@ struct addrspace *as_create(void);
 int               as_copy(struct addrspace *src, struct addrspace **ret, pid_t pid);
 void              as_activate(struct addrspace *);
 void              as_destroy(struct addrspace *);
+void              as_discard(struct addrspace *as, pid_t pid);
 
 int               as_define_region(struct addrspace *as, 
 				   vaddr_t vaddr, size_t sz,
@@ -2,74 +2,113 @@
 #define _FILE_H_
 
 #include <types.h>
-#include <array.h>
+#include <kern/limits.h>
+#include <bitmap.h>
 #include <synch.h>
 #include <vnode.h>
 #include <vfs.h>
 
 /* FILE API */
 
-/* global file table */
-struct array *filetable;
-struct lock  *filetable_lock;
+/* filemapping_lock protects the refcnt of every sys_filemapping. The
+ * offset has a lock of its own, see below */
+struct lock *filemapping_lock;
 
-/* system file table entry:
+/* open file, shared by every descriptor that refers to it:
  *  vn 	   - vnode representing the open file.
- *  offset - the offset into the file.
+ *  offlock- held from reading offset to storing the new one, across
+ *           the I/O, so reads and writes through the mapping don't
+ *           interleave or lose each other's updates. NULL for devices
+ *           that can't seek. Use filemapping_lockoffset/unlockoffset.
+ *  offset - the offset into the file. Only changed with offlock held,
+ *           through filemapping_setoffset, so it never changes on a
+ *           mapping without one.
  *  flags  - the oflags the filemapping was openned with
- *  refcnt - reference count of processes pointing to this vnode 
+ *  refcnt - number of descriptors, in any process, pointing to it.
+ *           The vnode is closed when the last one goes
  */ 
 
 struct sys_filemapping {
 	struct vnode *vn;
+	struct lock *offlock;
 	off_t offset;
 	int flags;
 	u_int32_t refcnt; 
 };
 
-/* a per-process file mapping is just an array of ints */
-typedef int proc_filemapping;
+/* per-process descriptor table. fd indexes files directly, and the
+ * bitmap has a bit set for each fd in use so the lowest free one can
+ * be found a word at a time. A table is only changed by the thread of
+ * the process that owns it, or before that process runs, so it needs
+ * no lock */
+struct fdtable {
+	struct sys_filemapping *files[OPEN_MAX];
+	struct bitmap *used;
+};
 
 /* bootstrap */
 void
 file_bootstrap(void);
 
-/* dump filetable contents of the current process */
+/* dump a descriptor table */
 void
-filetable_dump(struct array *ft);
+filetable_dump(struct fdtable *ft);
 
-/* resolves a per-process filetable mapping to a sys_filemapping */
+/* resolves a descriptor of the current process to its
+ * sys_filemapping, NULL if fd isn't open */
 struct sys_filemapping *
 resolvefd(int fd);
 
-/* places a new sys_filemapping into the filetable
- * returns a negative on error */
+/* makes a new sys_filemapping for the open vnode v, with one
+ * reference, returned in *ret. returns a negative on error */
 int
-newfilemapping(struct vnode *v, int flags); 
+newfilemapping(struct vnode *v, int flags, struct sys_filemapping **ret); 
+
+/* adds and drops references to a sys_filemapping. The vnode is closed
+ * and the mapping freed when the last reference is dropped */
+void
+filemapping_incref(struct sys_filemapping *fm);
+void
+filemapping_decref(struct sys_filemapping *fm);
+
+/* serialize use of a mapping's offset, held across the I/O that
+ * reads and advances it. No-ops for mappings without an offset */
+void
+filemapping_lockoffset(struct sys_filemapping *fm);
+void
+filemapping_unlockoffset(struct sys_filemapping *fm);
 
-/* adds the integer fd to the filetable of the process pid, returns a negative number
+/* stores a new offset, with the offset locked. Ignored for mappings
+ * without an offset */
+void
+filemapping_setoffset(struct sys_filemapping *fm, off_t offset);
+
+/* gives fm the lowest free descriptor of the current process, taking
+ * over the caller's reference. returns the fd, or a negative number
  * on error */
 int 
-addprocfilemapping(int fd, pid_t pid);
+addprocfilemapping(struct sys_filemapping *fm);
 
-/* set filetable for a process. returns 0 on success. */
+/* frees descriptor fd of the current process and drops its reference.
+ * returns a negative number on error */
 int
-setfiletable(pid_t pid, struct array *ft);
+closeprocfilemapping(int fd);
 
-/* given a process id copy a filetable */
-struct array *
-copyfiletable(pid_t);
+/* makes an empty descriptor table, NULL if out of memory */
+struct fdtable *
+filetable_create(void);
 
-/* increment the reference count of all sys_filemappings refered to 
- * by a process's filetable. To be called by copyfiletable. */
+/* closes every descriptor in ft and frees it */
 void
-incrementrefs(struct array *ft);
+filetable_destroy(struct fdtable *ft);
 
-/* finds the first free file descriptor in the filetable, if there
- * are no free slots, return -1 */
-/* since this is inefficient as a loop, it may be better to just define
- * an array to contain free descriptors */
+/* set filetable for a process. returns 0 on success. */
 int
-findfreedescriptor();
+setfiletable(pid_t pid, struct fdtable *ft);
+
+/* given a process id copy a filetable, taking a new reference on
+ * each open file. NULL if out of memory */
+struct fdtable *
+copyfiletable(pid_t);
 
 #endif
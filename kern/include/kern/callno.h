@@ -42,6 +42,11 @@
 #define SYS_lstat        31
 #define SYS_mmap	 32
 #define SYS_mprotect	 33
+#define SYS_nanosleep    34
+#define SYS_readv        35
+#define SYS_writev       36
+#define SYS_pread        37
+#define SYS_pwrite       38
 /*CALLEND*/
 
 
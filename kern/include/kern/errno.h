@@ -36,5 +36,7 @@
 #define ENOEXEC      24     /* File is not executable */
 #define E2BIG        25     /* Argument list too long */
 #define EBADF        26     /* Bad file number */
+#define ETIMEDOUT    27     /* Operation timed out */
+#define ECHILD       28     /* No child processes */
 
 #endif /* _KERN_ERRNO_H_ */
@@ -7,5 +7,11 @@
 /* Longest full path name */
 #define PATH_MAX   1024
 
+/* Most files a process can have open at once */
+#define OPEN_MAX   64
+
+/* Most buffers readv and writev take in one call */
+#define IOV_MAX    16
+
 
 #endif /* _KERN_LIMITS_H_ */
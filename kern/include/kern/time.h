@@ -0,0 +1,13 @@
+#ifndef _KERN_TIME_H_
+#define _KERN_TIME_H_
+
+/*
+ * Structure for nanosleep (seconds plus nanoseconds).
+ */
+
+struct timespec {
+	time_t tv_sec;		/* seconds */
+	u_int32_t tv_nsec;	/* nanoseconds, less than 1000000000 */
+};
+
+#endif /* _KERN_TIME_H_ */
@@ -0,0 +1,10 @@
+#ifndef _KERN_WAIT_H_
+#define _KERN_WAIT_H_
+
+/*
+ * Options for waitpid.
+ */
+
+#define WNOHANG      1      /* Return 0 at once if no child has exited */
+
+#endif /* _KERN_WAIT_H_ */
@@ -0,0 +1,45 @@
+#ifndef _KMEM_H_
+#define _KMEM_H_
+
+/*
+ * Object caches ("slabs") for kernel structures that are created and
+ * destroyed often.
+ *
+ * Each cache hands out objects of one size, carved from whole pages.
+ * Freed objects go back on their page's free stack and are handed out
+ * again, most recently freed first, without touching their contents.
+ * A page is only returned to the VM system once it is entirely free
+ * and the cache already holds another free page in reserve.
+ *
+ * Functions:
+ *     kmem_cache_create  - create a cache of objects of SIZE bytes. If
+ *                          CTOR is not NULL it is run on each object once,
+ *                          when the object is first carved out of a page,
+ *                          and not again when the object is reused. NAME
+ *                          is not copied. Returns NULL if out of memory.
+ *     kmem_cache_alloc   - get an object from the cache. Its contents are
+ *                          whatever CTOR left, or whatever the last user
+ *                          left when freeing it. Returns NULL if out of
+ *                          memory.
+ *     kmem_cache_free    - give an object back to the cache it came from.
+ *                          If the cache has a CTOR, the object should be
+ *                          returned in its constructed state.
+ *     kmem_cache_destroy - dispose of a cache. All of its objects must
+ *                          have been freed.
+ *     kmem_printstats    - print usage of every cache on the console.
+ *
+ * Objects must be small enough that at least one fits on a page along
+ * with the page's bookkeeping. All functions may be called with
+ * interrupts on or off, but not from interrupt handlers.
+ */
+
+struct kmem_cache;  /* Opaque. */
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     void (*ctor)(void *obj));
+void              *kmem_cache_alloc(struct kmem_cache *kc);
+void               kmem_cache_free(struct kmem_cache *kc, void *obj);
+void               kmem_cache_destroy(struct kmem_cache *kc);
+void               kmem_printstats(void);
+
+#endif /* _KMEM_H_ */
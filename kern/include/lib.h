@@ -86,10 +86,17 @@ u_int32_t random(void);
 /*
  * Kernel heap memory allocation. Like malloc/free.
  * If out of memory, kmalloc returns NULL.
+ *
+ * kheap_profile turns allocation profiling on (1) or off (0); while
+ * it is on, kheap_printsites reports the busiest kmalloc call sites
+ * and kheap_printlive lists the blocks not yet freed.
  */
 void *kmalloc(size_t sz);
 void kfree(void *ptr);
 void kheap_printstats(void);
+int kheap_profile(int on);
+void kheap_printsites(void);
+void kheap_printlive(void);
 
 /*
  * C string functions. 
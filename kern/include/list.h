@@ -0,0 +1,67 @@
+#ifndef _LIST_H_
+#define _LIST_H_
+
+/*
+ * Intrusive doubly linked list.
+ *
+ * The links live in the objects being listed: embed a struct listnode
+ * in the object, and listnode_init it with a pointer to the object.
+ * Nothing is ever allocated, so no operation can fail, and adding or
+ * removing an object is constant time. An object can be on as many
+ * lists at once as it has listnodes, but each listnode can be on only
+ * one list.
+ *
+ * Functions:
+ *     list_init     - initialize an empty list.
+ *     listnode_init - initialize a node that is part of object SELF.
+ *     list_isempty  - return true if the list is empty.
+ *     list_count    - return the number of objects on the list.
+ *     list_addhead  - add a node at the front of the list.
+ *     list_addtail  - add a node at the back of the list.
+ *     list_remove   - remove a node from the list it's on, which must be
+ *                     the list passed.
+ *     list_remhead  - remove the front node and return its object, or
+ *                     NULL if the list is empty.
+ *     list_head     - return the front object without removing it, or
+ *                     NULL if the list is empty.
+ *     list_move     - move everything on list SRC to list DST, which
+ *                     must be empty, in constant time.
+ *     list_first    - return the front node, or NULL if empty.
+ *     list_next     - return the node after LN, or NULL if LN is last.
+ *
+ * To walk a list, do something like
+ *      struct listnode *ln;
+ *
+ *      for (ln = list_first(l); ln != NULL; ln = list_next(l, ln)) {
+ *              struct foo *f = ln->ln_self;
+ *                :
+ *      }
+ *
+ * Synchronization is the caller's problem.
+ */
+
+struct listnode {
+	struct listnode *ln_prev;
+	struct listnode *ln_next;
+	void *ln_self;			/* object the node is part of */
+};
+
+struct list {
+	struct listnode l_head;		/* sentinel; not an object */
+	unsigned l_count;
+};
+
+void             list_init(struct list *l);
+void             listnode_init(struct listnode *ln, void *self);
+int              list_isempty(const struct list *l);
+unsigned         list_count(const struct list *l);
+void             list_addhead(struct list *l, struct listnode *ln);
+void             list_addtail(struct list *l, struct listnode *ln);
+void             list_remove(struct list *l, struct listnode *ln);
+void            *list_remhead(struct list *l);
+void            *list_head(const struct list *l);
+void             list_move(struct list *dst, struct list *src);
+struct listnode *list_first(const struct list *l);
+struct listnode *list_next(const struct list *l, const struct listnode *ln);
+
+#endif /* _LIST_H_ */
@@ -13,6 +13,7 @@
 #define R_B	0x10
 #define W_B	0x08
 #define X_B	0x04
+#define CONT_B  0x02	/* later frame of a multi-frame kernel allocation */
 #define SUPER_B 0x01
 
 #define FRAME( x ) (bframe + (x * PAGE_SIZE))
@@ -46,10 +47,15 @@ extern int pagetable_initialized;
  *    valid  ref  write   r     w     x  reserved supervisor
  */
 
+/* kdata   - for kernel frames, a pointer private to whoever allocated
+ *           the frame (kmalloc keeps its page bookkeeping here). 
+ *           Meaningless for user frames */
+
 struct pte
 {
 	vaddr_t   page;
 	pid_t     owner;
+	void     *kdata;
 	u_int8_t  control;
 };
 
@@ -69,6 +75,11 @@ addpage(vaddr_t page, pid_t pid, int read, int write, int execute, const void *c
 void
 invalidatepage(vaddr_t page);
 
+/* invalidate every user frame belonging to pid, for tearing down the
+ * pages of a process other than the current one */
+void
+invalidateframes(pid_t pid);
+
 /* returns a pointer to a pte belonging to the current process. 
  * Returns NULL on failure. */
 struct pte *
@@ -79,6 +90,17 @@ getpte(vaddr_t page);
 int
 getindex(vaddr_t page);
 
+/* attach a private pointer to the kernel frame holding kpage. Returns
+ * negative if the frame isn't managed by the pagetable (frames stolen
+ * before the pagetable existed) */
+int
+setkframedata(vaddr_t kpage, void *data);
+
+/* returns the pointer attached to the kernel frame holding kpage, or NULL
+ * if there is none */
+void *
+getkframedata(vaddr_t kpage);
+
 /* update permissions on a given page, returns negative on a error */
 int
 changeperms(vaddr_t page, int prots);
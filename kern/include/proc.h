@@ -5,31 +5,72 @@
 #include <array.h>
 #include <thread.h>
 #include <synch.h>
+#include <list.h>
+
+struct fdtable;
 
 /* PROCESS API */
 
-/* global process table */
-struct array *proctable;
-struct lock  *proctable_lock;
+/* pids run from PID_MIN, the kernel's own process, to PID_MAX-1.
+ * Freed pids are reused, least recently freed first */
+#define PID_MIN  1
+#define PID_MAX  1024
+
+/* the process table is hashed on pid. proctable_lock is taken shared
+ * for lookups and exclusive to change the table */
+struct rwlock *proctable_lock;
+
+/* protects exitcode, exited, parentpid and the children lists, and
+ * goes with each process's childexit cv. Taken before proctable_lock */
+struct lock   *procexit_lock;
 
 /* Each kernel thread should have a corresponding process structure 
  * A thread can find its own process structure by calling getprocess()
- * on curthread->t_pid, this is also simplified with the getcurprocess 
- * function provided in this API */
+ * on curthread->t_pid, or without touching the table through
+ * curthread->t_proc, which getcurprocess returns */
+
+/* default resident-set cap given to new processes, in frames.
+ * zero means new processes are not capped */
+extern u_int32_t proc_rsslimit;
 
 /* the process structure:
- *  parentpid - pid of the parent
- *  childexit - when a child exits, it will ring this CV to assist waitpid()
+ *  pid       - its own pid
+ *  filetable - its descriptors, closed as it exits
+ *  parentpid - pid of the parent, zero once the parent has exited
+ *  children  - live and exited children not yet reaped, linked on
+ *              their sibnode
+ *  childexit - when a child exits, it will ring this CV to assist
+ *              waitpid(), only the parent sleeps on it
  *  exitted   - flag marking whether the process has exitted or not
  *  exitcode  - self explanatory, undefined if exitted is 0
+ *  rss       - number of frames the process holds in the pagetable
+ *  swapped   - number of the process's pages sitting in the swap file
+ *  rsslimit  - resident-set cap in frames, zero for no cap. A process
+ *              at its cap replaces its own frames instead of others'
+ *  tickets   - share of the processor under stride scheduling, zero to
+ *              leave it to the thread's own tickets. Inherited on fork
+ *
+ * rss and swapped are maintained by the VM system under pagetable_lock
+ *
+ * An exited process stays in the table until its parent reaps it with
+ * waitpid. If the parent has exited too, or is the kernel, nobody
+ * will, so the process is removed as it exits.
  */
 struct process
 {
-	struct array *filetable;
+	pid_t pid;
+	struct listnode hashnode;	/* on its proctable hash chain */
+	struct fdtable *filetable;
 	pid_t parentpid;
+	struct list children;
+	struct listnode sibnode;	/* on the parent's children */
 	struct cv *childexit;
 	int8_t exited;
 	u_int8_t exitcode;
+	u_int32_t rss;
+	u_int32_t swapped;
+	u_int32_t rsslimit;
+	u_int32_t tickets;
 };
 
 /* bootstrap */
@@ -50,8 +91,56 @@ getcurprocess();
 pid_t 
 newprocess(pid_t parent);
 
-/* notifies the parent kernel thread by broadcasting on it's childexit cv */
+/* removes an exited process (or one whose fork failed) from the
+ * process table, freeing its pid and taking it off its parent's
+ * children. Call with procexit_lock held */
+void
+freeprocess(struct process *proc);
+
+/* exits the current process: closes its descriptors, records the
+ * exit code and notifies the parent by broadcasting on its childexit
+ * cv, or removes the process if there's nobody to reap it. Exited
+ * children are removed and live ones orphaned. The address space must
+ * already be gone, and the process entry must not be touched
+ * afterwards */
+void
+proc_exit(int exitcode);
+
+/* memory accounting, for use by the VM system. These never take
+ * proctable_lock, so they may be called with pagetable_lock held.
+ * proc_memaccount adds the deltas to the rss and swapped counters
+ * of pid, pids without a process entry (the kernel's 0) are ignored */
+void
+proc_memaccount(pid_t pid, int rssdelta, int swapdelta);
+
+/* returns nonzero if pid holds at least as many frames as its cap */
+int
+proc_atrsslimit(pid_t pid);
+
+/* returns nonzero if pid holds more frames than its cap */
+int
+proc_overrsslimit(pid_t pid);
+
+/* returns the number of processes currently over their cap */
+int
+proc_overrsscount(void);
+
+/* sets the resident-set cap of pid, returns negative on error */
+int
+proc_setrsslimit(pid_t pid, u_int32_t limit);
+
+/* stride scheduling tickets of pid, zero if pid has none set. Like
+ * the memory functions above, never takes proctable_lock */
+u_int32_t
+proc_gettickets(pid_t pid);
+
+/* sets the stride scheduling tickets of pid (zero to unset), returns
+ * negative on error */
+int
+proc_settickets(pid_t pid, u_int32_t tickets);
+
+/* debug */
 void
-ringparent();
+proc_memdump(void);
 
 #endif 
@@ -7,26 +7,66 @@
  *     scheduler     - run the scheduler and choose the next thread to run.
  *     make_runnable - add the specified thread to the run queue. If it's
  *                     already on the run queue or sleeping, weird things
- *                     may happen. Returns an error code.
+ *                     may happen. Returns an error code, though since
+ *                     the run queues need no memory it always succeeds.
+ *     scheduler_tick - charge a clock tick to the current thread. Returns
+ *                     nonzero if it should give up the processor.
+ *     scheduler_hasready - return nonzero if any thread is waiting to run.
+ *     scheduler_setquantum - set the top level's time slice, in clock
+ *                     ticks. Returns an error code.
+ *     scheduler_printstats - print quanta, statistics and the run queue.
+ *     scheduler_reprioritize - change a thread's effective priority,
+ *                     moving it to the matching run queue if it's on one.
+ *     scheduler_setmode - switch between SCHED_MLFQ and SCHED_STRIDE.
+ *     scheduler_getmode - return the mode in use.
+ *     scheduler_settickets - set a thread's share of the processor in
+ *                     stride mode, 1 to STRIDE_MAXTICKETS. Returns an
+ *                     error code.
+ *     scheduler_countswitch - count a context switch away from a thread,
+ *                     voluntary or not.
+ *     scheduler_setlatency - turn timing of run queue waits on or off.
+ *                     Off by default, since it reads the clock at every
+ *                     wakeup and dispatch.
+ *     scheduler_resetstats - zero utilisation, switch and wait counts.
+ *     scheduler_printlatency - print CPU utilisation, switch counts and
+ *                     run queue wait histograms, system-wide and per
+ *                     thread.
  *
  *     print_run_queue - dump the run queue to the console for debugging.
  *
  *     scheduler_bootstrap - initialize scheduler data 
  *                           (must happen early in boot)
  *     scheduler_shutdown -  clean up scheduler data
- *     scheduler_preallocate - ensure space for at least NUMTHREADS threads.
- *                           Returns an error code.
  */
 
 struct thread;
 
+/* Scheduler modes */
+#define SCHED_MLFQ    0	/* multi-level feedback queue (default) */
+#define SCHED_STRIDE  1	/* proportional share */
+
+/* Tickets for stride mode */
+#define STRIDE_DEFTICKETS  100
+#define STRIDE_MAXTICKETS  10000
+
 struct thread *scheduler(void);
 int make_runnable(struct thread *t);
+int scheduler_tick(void);
+int scheduler_hasready(void);
+int scheduler_setquantum(int ticks);
+void scheduler_printstats(void);
+void scheduler_reprioritize(struct thread *t, int epri);
+void scheduler_setmode(int mode);
+int scheduler_getmode(void);
+int scheduler_settickets(struct thread *t, int tickets);
+void scheduler_countswitch(struct thread *t, int involuntary);
+void scheduler_setlatency(int on);
+void scheduler_resetstats(void);
+void scheduler_printlatency(void);
 
 void print_run_queue(void);
 
 void scheduler_bootstrap(void);
-int scheduler_preallocate(int numthreads);
 void scheduler_killall(void);
 void scheduler_shutdown(void);
 
@@ -60,9 +60,11 @@ static
 int
 findfreeentry();
 
-/* implements the clock policy to choose a page to best swapout */
+/* implements the clock policy to choose a page to best swapout on behalf
+ * of process pid. A process at its resident-set cap gives up one of its
+ * own frames, otherwise frames of processes over their caps go first */
 unsigned int
-pickreplacement();
+pickreplacement(pid_t pid);
 
 /* debug */
 void
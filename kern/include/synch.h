@@ -5,6 +5,15 @@
 #ifndef _SYNCH_H_
 #define _SYNCH_H_
 
+#include <list.h>
+#include "opt-lockstat.h"
+
+/*
+ * The synchronization primitives keep their names in place rather than
+ * in a separate allocation. Longer names are truncated.
+ */
+#define SYNCH_NAMELEN 24
+
 /*
  * Dijkstra-style semaphore.
  * Operations:
@@ -19,7 +28,7 @@
  */
 
 struct semaphore {
-	char *name;
+	char name[SYNCH_NAMELEN];
 	volatile int count;
 };
 
@@ -49,12 +58,27 @@ void              sem_destroy(struct semaphore *);
  */
 
 struct lock {
-	char *name;
+	char name[SYNCH_NAMELEN];
 	// add what you need here
 	// (don't forget to mark things volatile as needed)
 	
 	struct thread *holder;
 	int held;
+	struct lock *heldnext;	/* next lock held by the same thread */
+
+#if OPT_LOCKSTAT
+	/* Contention statistics; see lockstat_dump */
+	struct listnode ls_node;	/* on the registry of all locks */
+	u_int32_t ls_acquires;		/* times acquired */
+	u_int32_t ls_contended;		/* ...of which had to wait */
+	time_t ls_waitsecs;		/* total time spent waiting */
+	u_int32_t ls_waitnsecs;
+	u_int32_t ls_maxwait;		/* longest wait, in microseconds */
+	time_t ls_holdsecs;		/* total time held */
+	u_int32_t ls_holdnsecs;
+	time_t ls_heldsecs;		/* when last acquired */
+	u_int32_t ls_heldnsecs;
+#endif
 };
 
 struct lock *lock_create(const char *name);
@@ -63,6 +87,85 @@ void         lock_release(struct lock *);
 int          lock_do_i_hold(struct lock *);
 void         lock_destroy(struct lock *);
 
+/*
+ * Priority inheritance.
+ *
+ * A thread that blocks in lock_acquire lends its priority to the
+ * holder of the lock, and on through any lock that holder is itself
+ * waiting for. A holder keeps the highest priority of the threads
+ * waiting on any lock it holds until it releases that lock.
+ *
+ *    lock_updatepriority - recompute the effective priority of a
+ *                   thread from its own priority and the locks it
+ *                   holds. Interrupts must be disabled.
+ */
+void         lock_updatepriority(struct thread *t);
+
+#if OPT_LOCKSTAT
+/*
+ * Lock statistics, with the "lockstat" kernel option.
+ *
+ * Every lock made by lock_create is registered, and counts its
+ * acquisitions, how many of them had to wait, and the total and
+ * longest wait and the total hold time as measured by gettime().
+ * Times are only measured once lockstat_bootstrap has been called,
+ * which has to wait until the clock is attached.
+ *
+ *    lockstat_bootstrap - start timing.
+ *    lockstat_dump  - print every lock's statistics, most total wait
+ *                     first. Returns an error code.
+ *    lockstat_reset - zero every lock's statistics.
+ */
+void         lockstat_bootstrap(void);
+int          lockstat_dump(void);
+void         lockstat_reset(void);
+#endif
+
+
+/*
+ * Reader-writer lock.
+ * Operations:
+ *    rwlock_acquire_read   - Get the lock shared. Any number of readers
+ *                   can hold the lock at once, but not while a writer
+ *                   does.
+ *    rwlock_release_read   - Give up a shared hold.
+ *    rwlock_acquire_write  - Get the lock exclusive. A writer excludes
+ *                   readers and other writers.
+ *    rwlock_release_write  - Give up an exclusive hold.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                   the lock exclusive.
+ *
+ * Writers are preferred: once a writer is waiting, new readers wait
+ * behind it instead of joining the readers already in, so a stream of
+ * readers can't starve writers. In turn, a writer releasing the lock
+ * lets in every reader that queued up behind it before the next
+ * writer, so writers can't starve readers either. Writers are served
+ * in the order they arrived.
+ *
+ * A thread may not acquire a lock it already holds, shared or
+ * exclusive. There is no priority inheritance through these locks.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+
+struct rwlock {
+	char name[SYNCH_NAMELEN];
+	volatile int rw_readers;	/* readers holding the lock */
+	struct thread *volatile rw_writer;	/* writer holding it */
+	volatile int rw_rwaiting;	/* readers waiting */
+	volatile int rw_wwaiting;	/* writers waiting */
+	volatile unsigned rw_rgen;	/* bumped as waiting readers get in */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void           rwlock_acquire_read(struct rwlock *);
+void           rwlock_release_read(struct rwlock *);
+void           rwlock_acquire_write(struct rwlock *);
+void           rwlock_release_write(struct rwlock *);
+int            rwlock_do_i_hold_write(struct rwlock *);
+void           rwlock_destroy(struct rwlock *);
+
 
 /*
  * Condition variable.
@@ -74,10 +177,13 @@ void         lock_destroy(struct lock *);
  * Operations:
  *    cv_wait      - Release the supplied lock, go to sleep, and, after
  *                   waking up again, re-acquire the lock.
+ *    cv_timedwait - Like cv_wait, but give up waiting after the given
+ *                   number of clock ticks. Returns 0 if signalled,
+ *                   ETIMEDOUT if not. The lock is re-acquired either way.
  *    cv_signal    - Wake up one thread that's sleeping on this CV.
  *    cv_broadcast - Wake up all threads sleeping on this CV.
  *
- * For all three operations, the current thread must hold the lock passed 
+ * For all of these operations, the current thread must hold the lock passed 
  * in. Note that under normal circumstances the same lock should be used
  * on all operations with any particular CV.
  *
@@ -91,13 +197,14 @@ void         lock_destroy(struct lock *);
  */
 
 struct cv {
-	char *name;
+	char name[SYNCH_NAMELEN];
 	// add what you need here
 	// (don't forget to mark things volatile as needed)
 };
 
 struct cv *cv_create(const char *name);
 void       cv_wait(struct cv *cv, struct lock *lock);
+int        cv_timedwait(struct cv *cv, struct lock *lock, u_int32_t ticks);
 void       cv_signal(struct cv *cv, struct lock *lock);
 void       cv_broadcast(struct cv *cv, struct lock *lock);
 void       cv_destroy(struct cv *);
@@ -5,7 +5,82 @@
  * Prototypes for IN-KERNEL entry points for system call implementations.
  */
 
+struct trapframe;
+struct stat;
+struct timespec;
+struct iovec;
+
+int sys__exit(int exitcode);
+int sys_execv(const char *path, char *argv[]);
+int sys_fork(struct trapframe *tf);
+pid_t sys_waitpid(pid_t pid, int *status, int options);
+int sys_open(char *path, int flags);
+int sys_read(int fd, void *buf, size_t buflen);
+int sys_write(int fd, const void *buf, size_t nbytes);
+int sys_close(int fd);
 int sys_reboot(int code);
+off_t sys_lseek(int fd, off_t pos, int whence);
+int sys_fstat(int fd, struct stat *statbuf);
+int sys_mprotect(unsigned long addr, size_t len, int protections);
+
+int sys_nanosleep(const struct timespec *req, struct timespec *rem);
+
+int sys_readv(int fd, const struct iovec *iov, int iovcnt);
+int sys_writev(int fd, const struct iovec *iov, int iovcnt);
+
+int sys_pread(int fd, void *buf, size_t buflen, off_t pos);
+int sys_pwrite(int fd, const void *buf, size_t buflen, off_t pos);
+
+/*
+ * System call table.
+ *
+ * One entry per call number, giving a wrapper that takes the call's
+ * arguments from the trapframe and calls the sys_ function with them,
+ * and whether that returns an error code or a value that is a negated
+ * error code when negative. The machine-dependent syscall handler
+ * calls the wrapper; arguments are all passed as 32-bit words.
+ *
+ * Each entry also counts its calls and the calls that failed, and the
+ * total and longest time from entry to return as measured by gettime(),
+ * including any time spent asleep. Timing starts at syscall_bootstrap.
+ *
+ *    syscall_bootstrap  - start timing and attach the "syscalls:"
+ *                         device, reading which gives the statistics
+ *                         as text.
+ *    syscall_lookup     - the entry for CALLNO, or NULL if there is no
+ *                         such call.
+ *    syscall_enter      - count a call to SD, and note the time it
+ *                         started in *SECS and *NSECS.
+ *    syscall_leave      - account for a call to SD that started at
+ *                         SECS/NSECS and returned ERR.
+ *    syscall_printstats - print the statistics of every call made.
+ *    syscall_resetstats - zero every call's statistics.
+ */
+
+/* sd_conv */
+#define SC_ERRNO       0	/* returns 0 or an error code */
+#define SC_NEGERR      1	/* returns a value, or -error code */
+
+struct syscall_desc {
+	const char *sd_name;
+	int sd_conv;
+	int (*sd_func)(struct trapframe *tf);
+
+	/* Statistics */
+	u_int32_t sd_ncalls;
+	u_int32_t sd_nerrors;
+	time_t sd_totsecs;		/* total time in the call */
+	u_int32_t sd_totnsecs;
+	u_int32_t sd_maxusecs;		/* longest call, in microseconds */
+};
 
+void                 syscall_bootstrap(void);
+struct syscall_desc *syscall_lookup(int callno);
+void                 syscall_enter(struct syscall_desc *sd,
+				   time_t *secs, u_int32_t *nsecs);
+void                 syscall_leave(struct syscall_desc *sd, int err,
+				   time_t secs, u_int32_t nsecs);
+void                 syscall_printstats(void);
+void                 syscall_resetstats(void);
 
 #endif /* _SYSCALL_H_ */
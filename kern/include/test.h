@@ -18,6 +18,7 @@ int createcars(int, char **);
 int arraytest(int, char **);
 int bitmaptest(int, char **);
 int queuetest(int, char **);
+int listtest(int, char **);
 
 /* thread tests */
 int threadtest(int, char **);
@@ -26,6 +27,9 @@ int threadtest3(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
+int rwlocktest(int, char **);
+int stridetest(int, char **);
+int wqtest(int, char **);
 
 /* filesystem tests */
 int fstest(int, char **);
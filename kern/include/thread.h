@@ -7,9 +7,35 @@
 
 /* Get machine-dependent stuff */
 #include <machine/pcb.h>
+#include <list.h>
 
 
+/* Longest thread name kept; longer names are truncated. */
+#define THREAD_NAMELEN 32
+
 struct addrspace;
+struct lock;
+struct process;
+struct wchan;
+
+/*
+ * Thread priorities. A thread of higher priority always runs in
+ * preference to one of lower priority. New threads get their
+ * creator's priority; the first thread gets PRI_NORMAL.
+ */
+#define PRI_LOW     0
+#define PRI_NORMAL  1
+#define PRI_HIGH    2
+#define PRI_MIN     PRI_LOW
+#define PRI_MAX     PRI_HIGH
+#define NPRIO       (PRI_MAX - PRI_MIN + 1)
+
+/*
+ * Buckets in run queue wait histograms. Bucket 0 counts waits under
+ * 16 microseconds, and each bucket after covers twice the time of
+ * the one before, except the last, which takes everything longer.
+ */
+#define LAT_NBUCKETS 14
 
 struct thread {
 	/**********************************************************/
@@ -17,9 +43,50 @@ struct thread {
 	/**********************************************************/
 	
 	struct pcb t_pcb;
-	char *t_name;
+	char t_name[THREAD_NAMELEN];
 	const void *t_sleepaddr;
+	struct wchan *t_sleepchan;	/* wait channel we're asleep in */
+	struct wchan *t_wchan;		/* spare wait channel, while awake */
+	int t_timedout;			/* woken by thread_sleep_timeout's timer */
 	char *t_stack;
+
+	/*
+	 * Link for whichever list the thread is on: a run queue, a wait
+	 * channel, the zombies or the pool. It can only be on one.
+	 */
+	struct listnode t_listnode;
+
+	/* Scheduler state - private to scheduler.c */
+	struct list *t_runq;		/* run queue we're on, if any */
+	int t_level;			/* run queue level */
+	int t_ticksleft;		/* ticks left in quantum */
+	unsigned t_boostgen;		/* boost generation last seen */
+	u_int32_t t_tickets;		/* stride mode: share */
+	u_int32_t t_stride;		/* stride mode: pass per tick */
+	u_int32_t t_pass;		/* stride mode: virtual time */
+	struct thread *t_hleft;		/* stride mode: heap children */
+	struct thread *t_hright;
+
+	/* CPU usage statistics */
+	u_int32_t t_cputicks;		/* clock ticks charged */
+	u_int32_t t_nvcsw;		/* times switched out voluntarily */
+	u_int32_t t_nivcsw;		/* times preempted */
+
+	/* Run queue wait, while being measured (scheduler_setlatency) */
+	time_t t_readysecs;		/* when made runnable; 0 if not known */
+	u_int32_t t_readynsecs;
+	u_int32_t t_latcount;		/* waits measured */
+	u_int32_t t_lattotal;		/* total wait, microseconds */
+	u_int32_t t_latmax;		/* longest wait, microseconds */
+	u_int32_t t_lathist[LAT_NBUCKETS];
+
+	struct listnode t_allnode;	/* on the list of all threads */
+
+	/* Priority and priority inheritance */
+	int t_priority;			/* own priority */
+	int t_epriority;		/* priority after inheritance */
+	struct lock *t_heldlocks;	/* locks held, for inheritance */
+	struct lock *t_waitlock;	/* lock we're waiting for, if any */
 	
 	/**********************************************************/
 	/* Public thread members - can be used by other code      */
@@ -41,9 +108,12 @@ struct thread {
 	/*
 	 * This is public because the process API needs access to this.
 	 * to resolve a process structure from curthread.
+	 * t_proc is the process t_pid names, kept so the syscall paths
+	 * don't have to look it up in the process table each time.
 	 */
 	
 	pid_t t_pid;
+	struct process *t_proc;
 };
 
 /* Call once during startup to allocate data structures. */
@@ -70,6 +140,12 @@ int thread_fork(const char *name,
 		void (*func)(void *, unsigned long),
 		struct thread **ret);
 
+/*
+ * Change the name of a thread. The name is copied, and truncated to
+ * THREAD_NAMELEN-1 characters.
+ */
+void thread_setname(struct thread *thread, const char *name);
+
 /*
  * Cause the current thread to exit.
  * Interrupts need not be disabled.
@@ -91,18 +167,53 @@ void thread_yield(void);
  */
 void thread_sleep(const void *addr);
 
+/*
+ * Like thread_sleep, but wake up anyway after the specified number of
+ * clock ticks. Returns 0 if woken normally, ETIMEDOUT if the time ran
+ * out first; 0 ticks times out at once without sleeping.
+ * Interrupts must be disabled.
+ */
+int thread_sleep_timeout(const void *addr, u_int32_t ticks);
+
 /*
  * Cause all threads sleeping on the specified address to wake up.
  * Interrupts must be disabled.
  */
 void thread_wakeup(const void *addr);
 
+/*
+ * Wake up only the thread that has been sleeping longest on the
+ * specified address, and return it; NULL if there was none.
+ * Interrupts must be disabled.
+ */
+struct thread *thread_wakeone(const void *addr);
+
 /*
  * Return nonzero if there are any threads sleeping on the specified
  * address. Meant only for diagnostic purposes.
  */
 int thread_hassleepers(const void *addr);
 
+/*
+ * Return the highest effective priority of the threads sleeping on
+ * the specified address, or -1 if there are none.
+ * Interrupts must be disabled.
+ */
+int thread_sleeperpriority(const void *addr);
+
+/*
+ * Call FUNC(T, DATA) for every thread that hasn't exited.
+ * Interrupts must be disabled, and FUNC may not sleep.
+ */
+void thread_foreach(void (*func)(struct thread *t, void *data), void *data);
+
+/*
+ * Set the priority of a thread. Its effective priority will not drop
+ * below what it has inherited through the locks it holds.
+ * Interrupts need not be disabled.
+ */
+void thread_setpriority(struct thread *t, int priority);
+
 /*
  * returns true (1) if the number of threads in the system is
  * equal to 1, otherwise returns fals (0).
@@ -0,0 +1,45 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+/*
+ * Kernel timers.
+ *
+ * A timer calls a function once, from the clock interrupt, after a
+ * given number of clock ticks (HZ per second). Pending timers are
+ * kept in a hashed timing wheel: one list per slot, NTIMERSLOTS
+ * slots, a timer going in the slot its expiry tick falls in. Adding
+ * and cancelling a timer are constant time; each tick only looks at
+ * the timers in one slot.
+ *
+ * The struct timer belongs to the caller, who must keep it around
+ * until it has fired or been cancelled. Timer functions run with
+ * interrupts off in interrupt context, so they may not sleep.
+ *
+ * Functions:
+ *     timer_init   - set up TM to call FUNC(DATA) when it fires.
+ *     timer_add    - start TM; it fires after TICKS ticks (at least 1).
+ *                    TM must not already be pending.
+ *     timer_cancel - stop TM if it's pending. Returns nonzero if it
+ *                    was, zero if it had already fired or wasn't
+ *                    started.
+ *     timer_now    - return the number of ticks since boot. Wraps.
+ *     timer_sleep  - put the current thread to sleep for TICKS ticks.
+ *     timer_tick   - called by hardclock on each tick to fire timers.
+ */
+
+struct timer {
+	struct timer *tm_next;
+	struct timer **tm_prevp;	/* NULL if not pending */
+	u_int32_t tm_expires;		/* tick at which it fires */
+	void (*tm_func)(void *data);
+	void *tm_data;
+};
+
+void      timer_init(struct timer *tm, void (*func)(void *), void *data);
+void      timer_add(struct timer *tm, u_int32_t ticks);
+int       timer_cancel(struct timer *tm);
+u_int32_t timer_now(void);
+void      timer_sleep(u_int32_t ticks);
+void      timer_tick(void);
+
+#endif /* _TIMER_H_ */
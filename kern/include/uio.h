@@ -2,8 +2,9 @@
 #define _UIO_H_
 
 /*
- * Like BSD uio, but simplified a bit. (In BSD, there can be more than one
- * iovec in a uio.)
+ * Like BSD uio, but simplified a bit. A uio may cover several iovecs,
+ * which are transferred in order; mk_kuio and mk_uuio set up a single
+ * one, held in uio_iovec.
  */
 
 enum uio_rw {
@@ -28,7 +29,9 @@ struct iovec {
 #define iov_ubase  iov_un.un_ubase
 
 struct uio {
-	struct iovec      uio_iovec;       /* Data block */
+	struct iovec     *uio_iov;         /* Data blocks */
+	unsigned          uio_iovcnt;      /* Number of blocks left */
+	struct iovec      uio_iovec;       /* Storage for a single block */
 	off_t             uio_offset;      /* desired offset into object */
 	size_t            uio_resid;       /* Remaining amt of data to xfer */
 	enum uio_seg      uio_segflg;      /* what kind of pointer we have */
@@ -43,7 +46,8 @@ struct uio {
  * fields as well.
  *
  * Before calling this, you should
- *   (1) set up uio_iovec to point to the buffer you want to transfer to;
+ *   (1) set up uio_iov and uio_iovcnt to point to the buffers you want
+ *       to transfer to;
  *   (2) initialize uio_offset as desired;
  *   (3) initialize uio_resid to the total amount of data that can be 
  *       transferred through this uio;
@@ -53,8 +57,8 @@ struct uio {
  *       should be found.
  *
  * After calling, 
- *   (1) the contents of uio_iovec may be altered and should not be 
- *       interpreted;
+ *   (1) uio_iov, uio_iovcnt and the contents of the iovecs may be
+ *       altered and should not be interpreted;
  *   (2) uio_offset will have been incremented by the amount transferred;
  *   (3) uio_resid will have been decremented by the amount transferred;
  *   (4) uio_segflg, uio_rw, and uio_space will be unchanged.
@@ -83,4 +87,22 @@ int uiomovezeros(size_t len, struct uio *uio);
  */
 void mk_kuio(struct uio *, void *kbuf, size_t len, off_t pos, enum uio_rw rw);
 
+/*
+ * Initialize uio for I/O straight to or from a user buffer in the
+ * current address space. Faults on the buffer show up as EFAULT from
+ * uiomove.
+ */
+void mk_uuio(struct uio *, userptr_t ubuf, size_t len, off_t pos,
+	     enum uio_rw rw);
+
+/*
+ * Initialize uio for I/O on IOVCNT user buffers in the current address
+ * space, described by the array UIOV in user memory. The array is
+ * copied into IOV, which must have room for IOVCNT entries and stay
+ * around as long as the uio. Returns EINVAL if IOVCNT is out of range
+ * or the lengths overflow, EFAULT if UIOV can't be read.
+ */
+int mk_uuiov(struct uio *, struct iovec *iov, const_userptr_t uiov,
+	     int iovcnt, off_t pos, enum uio_rw rw);
+
 #endif /* _UIO_H_ */
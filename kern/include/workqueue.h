@@ -0,0 +1,73 @@
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+/*
+ * Workqueues: deferred work run by kernel worker threads.
+ *
+ * A workqueue is a FIFO of work items served by a fixed set of worker
+ * threads. Submitting work only links the item onto the queue and
+ * wakes a worker, so it can be done from anywhere, including
+ * interrupt handlers; the function itself runs later, in a worker,
+ * with interrupts on, and may sleep.
+ *
+ * The struct work belongs to the caller, who must keep it around
+ * until it has run or been cancelled. An item can be on a queue only
+ * once at a time, but it may be resubmitted (even by its own
+ * function) once a worker has taken it off.
+ *
+ * sys_wq is a queue for general use, started at boot.
+ *
+ * Functions:
+ *     workqueue_bootstrap - start sys_wq.
+ *     workqueue_create    - create a queue NAME served by NTHREADS
+ *                           workers. Returns NULL if out of memory.
+ *     workqueue_destroy   - flush a queue, stop its workers and free it.
+ *                           No delayed work may be outstanding.
+ *     work_init           - set up W to call FUNC(DATA).
+ *     workqueue_submit    - queue W on WQ to run as soon as a worker is
+ *                           free. Returns EBUSY if W is already pending.
+ *     workqueue_submit_delayed - queue W on WQ after TICKS clock ticks
+ *                           (at once if TICKS is 0). Returns EBUSY if W
+ *                           is already pending.
+ *     workqueue_cancel    - take W off its queue, or stop its timer, if
+ *                           it hasn't started running. Returns nonzero
+ *                           if it was pending.
+ *     workqueue_flush     - wait until WQ has nothing queued or running.
+ *                           Work submitted meanwhile is waited for too.
+ *                           May not be called from one of WQ's workers.
+ *     workqueue_printstats - print every queue's statistics.
+ */
+
+#include <list.h>
+#include <timer.h>
+
+struct workqueue;  /* Opaque. */
+
+struct work {
+	struct listnode wk_node;	/* on the queue */
+	struct timer wk_timer;		/* for delayed submission */
+	struct workqueue *wk_wq;	/* queue it's pending on */
+	int wk_state;			/* WORK_* below */
+	void (*wk_func)(void *data);
+	void *wk_data;
+};
+
+/* Work states */
+#define WORK_IDLE     0	/* not pending; may be running */
+#define WORK_DELAYED  1	/* waiting for its timer */
+#define WORK_QUEUED   2	/* waiting for a worker */
+
+extern struct workqueue *sys_wq;
+
+void              workqueue_bootstrap(void);
+struct workqueue *workqueue_create(const char *name, int nthreads);
+void              workqueue_destroy(struct workqueue *wq);
+void              work_init(struct work *w, void (*func)(void *), void *data);
+int               workqueue_submit(struct workqueue *wq, struct work *w);
+int               workqueue_submit_delayed(struct workqueue *wq,
+					   struct work *w, u_int32_t ticks);
+int               workqueue_cancel(struct work *w);
+void              workqueue_flush(struct workqueue *wq);
+void              workqueue_printstats(void);
+
+#endif /* _WORKQUEUE_H_ */
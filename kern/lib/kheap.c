@@ -1,6 +1,9 @@
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <vm.h>
+#include <pagetable.h>
+#include <clock.h>
 #include <machine/spl.h>
 
 static
@@ -41,6 +44,10 @@ fill_deadbeef(void *vptr, size_t len)
 //    cannot recursively use the subpage allocator. (We could probably
 //    make that work, but it would be painful.)
 //
+//    kfree finds a block's page through the pagetable entry of the
+//    page it lives in, which points back at the page's entry in that
+//    table, rather than by searching all pages.
+//
 
 #undef  SLOW	/* consistency checks */
 #undef SLOWER	/* lots of consistency checks */
@@ -69,7 +76,7 @@ struct freelist {
 
 struct pageref {
 	struct pageref *next_samesize;
-	struct pageref *next_all;
+	struct pageref **prev_samesize;
 	vaddr_t pageaddr_and_blocktype;
 	u_int16_t freelist_offset;
 	u_int16_t nfree;
@@ -84,51 +91,127 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * This is cheesy. 
+ * Pageref storage.
  *
- * The problem is not that it's wasteful - we can only allocate whole
- * pages of pageref structures at a time anyway. The problem is that
- * we really ought to be able to have more than one of these pages.
+ * Pagerefs live in whole pages of pageref structures, each headed by
+ * a bitmap of which slots are in use. The first such page is in the
+ * kernel BSS so early kmallocs don't depend on anything; further
+ * pages are taken from alloc_kpages() as the heap grows, and given
+ * back once every pageref on them is free again. One page of pagerefs
+ * manages about 1M of kernel heap, so the list stays short.
  *
- * However, for the time being, one page worth of pagerefs gives us
- * 256 pagerefs; this lets us manage 256 * 4k = 1M of kernel heap.
- * That would be twice as much memory as we get for *everything*.
- * Thus, we will cheat and not allow any mechanism for having a second
- * page of pageref structs.
+ * Pageref pages are page-aligned, so the page a pageref lives on is
+ * found by masking its address.
+ */
+
+#define PRP_HEADER  64
+#define NPAGEREFS   ((PAGE_SIZE - PRP_HEADER) / sizeof(struct pageref))
+#define INUSE_WORDS DIVROUNDUP(NPAGEREFS, 32)
+
+struct pagerefpage {
+	struct pagerefpage *next;
+	unsigned nfree;
+	u_int32_t inuse[INUSE_WORDS];
+	struct pageref refs[NPAGEREFS];
+};
+
+#define PR_REFPAGE(pr)  ((struct pagerefpage *)((vaddr_t)(pr) & PAGE_FRAME))
+
+static struct pagerefpage firstrefpage __attribute__((__aligned__(PAGE_SIZE)));
+static struct pagerefpage *refpages;
+
+/* total number of pagerefs across all pageref pages */
+static unsigned npagerefs;
+
+/*
+ * Index of the lowest clear bit in a word that is not all ones.
  *
- * Then, since the size is fixed at one page, we'll simplify a bit
- * further by allocating the page in the kernel BSS instead of calling
- * alloc_kpages to get it.
+ * x & -x isolates the lowest set bit of x; multiplying that by a de
+ * Bruijn constant puts a unique pattern in the top five bits, which
+ * indexes the table. No loop over the bits is needed.
  */
+static const unsigned char debruijn_bitpos[32] = {
+	0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+	31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
+};
 
-#define NPAGEREFS (PAGE_SIZE / sizeof(struct pageref))
-static struct pageref pagerefs[NPAGEREFS];
+static
+inline
+unsigned
+ffz(u_int32_t word)
+{
+	u_int32_t x = ~word;
 
-#define INUSE_WORDS (NPAGEREFS/32)
-static u_int32_t pagerefs_inuse[INUSE_WORDS];
+	assert(x != 0);
+	return debruijn_bitpos[((x & -x) * 0x077CB531U) >> 27];
+}
+
+static
+void
+initrefpage(struct pagerefpage *prp)
+{
+	unsigned i;
+
+	for (i=0; i<INUSE_WORDS; i++) {
+		prp->inuse[i] = 0;
+	}
+
+	/* Mark the bits past the last pageref in use so ffz skips them */
+	for (i=NPAGEREFS; i<INUSE_WORDS*32; i++) {
+		prp->inuse[i/32] |= ((u_int32_t)1) << (i%32);
+	}
+
+	prp->nfree = NPAGEREFS;
+	prp->next = refpages;
+	refpages = prp;
+	npagerefs += NPAGEREFS;
+}
 
 static
 struct pageref *
 allocpageref(void)
 {
-	unsigned i,j;
-	u_int32_t k;
+	struct pagerefpage *prp;
+	vaddr_t page;
+	unsigned i, j;
+
+	assert(curspl>0);
+	assert(sizeof(struct pagerefpage) <= PAGE_SIZE);
+
+	if (refpages == NULL) {
+		initrefpage(&firstrefpage);
+	}
+
+	for (prp = refpages; prp != NULL; prp = prp->next) {
+		if (prp->nfree > 0) {
+			break;
+		}
+	}
+
+	if (prp == NULL) {
+		/* All full; get another page of pagerefs. */
+		page = alloc_kpages(1);
+		if (page == 0) {
+			/* ran out */
+			return NULL;
+		}
+		prp = (struct pagerefpage *)page;
+		initrefpage(prp);
+	}
 
 	for (i=0; i<INUSE_WORDS; i++) {
-		if (pagerefs_inuse[i]==0xffffffff) {
+		if (prp->inuse[i]==0xffffffff) {
 			/* full */
 			continue;
 		}
-		for (k=1,j=0; k!=0; k<<=1,j++) {
-			if ((pagerefs_inuse[i] & k)==0) {
-				pagerefs_inuse[i] |= k;
-				return &pagerefs[i*32 + j];
-			}
-		}
-		assert(0);
+		j = ffz(prp->inuse[i]);
+		prp->inuse[i] |= ((u_int32_t)1) << j;
+		prp->nfree--;
+		return &prp->refs[i*32 + j];
 	}
 
-	/* ran out */
+	/* nfree said there was one */
+	panic("kmalloc: pageref page %p has no free pagerefs\n", prp);
 	return NULL;
 }
 
@@ -136,21 +219,143 @@ static
 void
 freepageref(struct pageref *p)
 {
+	struct pagerefpage *prp, **guy;
 	size_t i, j;
 	u_int32_t k;
 
-	j = p-pagerefs;
+	prp = PR_REFPAGE(p);
+	j = p - prp->refs;
 	assert(j < NPAGEREFS);  /* note: j is unsigned, don't test < 0 */
 	i = j/32;
 	k = ((u_int32_t)1) << (j%32);
-	assert((pagerefs_inuse[i] & k) != 0);
-	pagerefs_inuse[i] &= ~k;
+	assert((prp->inuse[i] & k) != 0);
+	prp->inuse[i] &= ~k;
+	prp->nfree++;
+
+	if (prp->nfree < NPAGEREFS || prp == &firstrefpage) {
+		return;
+	}
+
+	/* Whole page of pagerefs is free; give it back. */
+	for (guy = &refpages; *guy; guy = &(*guy)->next) {
+		if (*guy == prp) {
+			*guy = prp->next;
+			break;
+		}
+	}
+	npagerefs -= NPAGEREFS;
+	free_kpages((vaddr_t)prp);
 }
 
 ////////////////////////////////////////
 
-static struct pageref *sizebases[NSIZES];
-static struct pageref *allbase;
+/*
+ * Each size has three lists of pages: pages with some blocks free
+ * (partial), pages with none free (full), and at most one page with
+ * every block free (empty), kept back so a kmalloc/kfree pair at a
+ * page boundary doesn't fetch and release a page each time. Pages
+ * move between lists in constant time as their free counts change.
+ */
+
+static struct pageref *partialbases[NSIZES];
+static struct pageref *fullbases[NSIZES];
+static struct pageref *emptybases[NSIZES];
+
+static
+void
+pr_link(struct pageref **head, struct pageref *pr)
+{
+	pr->next_samesize = *head;
+	if (*head != NULL) {
+		(*head)->prev_samesize = &pr->next_samesize;
+	}
+	pr->prev_samesize = head;
+	*head = pr;
+}
+
+static
+void
+pr_unlink(struct pageref *pr)
+{
+	*pr->prev_samesize = pr->next_samesize;
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->prev_samesize = pr->prev_samesize;
+	}
+	pr->next_samesize = NULL;
+	pr->prev_samesize = NULL;
+}
+
+/*
+ * Finding the pageref for a block.
+ *
+ * Pages handed out by the pagetable carry a pointer back to their
+ * pageref in their pagetable entry. Pages allocated before the
+ * pagetable existed aren't in it; there are only ever a few of those,
+ * so they're kept in a small table and searched.
+ */
+
+#define NUNMAPPED 32
+static struct pageref *unmapped[NUNMAPPED];
+
+static
+int
+mappageref(struct pageref *pr)
+{
+	unsigned i;
+
+	if (setkframedata(PR_PAGEADDR(pr), pr) == 0) {
+		return 0;
+	}
+
+	for (i=0; i<NUNMAPPED; i++) {
+		if (unmapped[i] == NULL) {
+			unmapped[i] = pr;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static
+void
+unmappageref(struct pageref *pr)
+{
+	unsigned i;
+
+	if (setkframedata(PR_PAGEADDR(pr), NULL) == 0) {
+		return;
+	}
+
+	for (i=0; i<NUNMAPPED; i++) {
+		if (unmapped[i] == pr) {
+			unmapped[i] = NULL;
+			return;
+		}
+	}
+}
+
+static
+struct pageref *
+findpageref(vaddr_t addr)
+{
+	struct pageref *pr;
+	unsigned i;
+
+	pr = getkframedata(addr);
+	if (pr != NULL) {
+		return pr;
+	}
+
+	for (i=0; i<NUNMAPPED; i++) {
+		pr = unmapped[i];
+		if (pr != NULL && PR_PAGEADDR(pr) == (addr & PAGE_FRAME)) {
+			return pr;
+		}
+	}
+
+	return NULL;
+}
 
 ////////////////////////////////////////
 
@@ -202,31 +407,48 @@ checksubpage(struct pageref *pr)
 #endif
 
 #ifdef SLOWER
+static
+void
+checksubpagelist(struct pageref *pr, int blktype, unsigned *count)
+{
+	for (; pr != NULL; pr = pr->next_samesize) {
+		assert(PR_BLOCKTYPE(pr) == blktype);
+		assert(*pr->prev_samesize == pr);
+		assert(findpageref(PR_PAGEADDR(pr)) == pr);
+		checksubpage(pr);
+		assert(*count < npagerefs);
+		(*count)++;
+	}
+}
+
 static
 void
 checksubpages(void)
 {
 	struct pageref *pr;
 	int i;
-	unsigned sc=0, ac=0;
+	unsigned sc=0;
 
 	assert(curspl>0);
 
 	for (i=0; i<NSIZES; i++) {
-		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
-			checksubpage(pr);
-			assert(sc < NPAGEREFS);
-			sc++;
+		for (pr = partialbases[i]; pr; pr = pr->next_samesize) {
+			assert(pr->nfree > 0);
+			assert(pr->nfree < PAGE_SIZE / sizes[i]);
+		}
+		for (pr = fullbases[i]; pr; pr = pr->next_samesize) {
+			assert(pr->nfree == 0);
+		}
+		pr = emptybases[i];
+		if (pr != NULL) {
+			assert(pr->next_samesize == NULL);
+			assert(pr->nfree == PAGE_SIZE / sizes[i]);
 		}
-	}
 
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
-		checksubpage(pr);
-		assert(ac < NPAGEREFS);
-		ac++;
+		checksubpagelist(partialbases[i], i, &sc);
+		checksubpagelist(fullbases[i], i, &sc);
+		checksubpagelist(emptybases[i], i, &sc);
 	}
-
-	assert(sc==ac);
 }
 #else
 #define checksubpages() 
@@ -289,14 +511,23 @@ void
 kheap_printstats(void)
 {
 	struct pageref *pr;
+	int i;
 
 	/* print the whole thing with interrupts off */
 	int spl = splhigh();
 
 	kprintf("Subpage allocator status:\n");
 
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
-		dumpsubpage(pr);
+	for (i=0; i<NSIZES; i++) {
+		for (pr = partialbases[i]; pr != NULL; pr = pr->next_samesize) {
+			dumpsubpage(pr);
+		}
+		for (pr = fullbases[i]; pr != NULL; pr = pr->next_samesize) {
+			dumpsubpage(pr);
+		}
+		for (pr = emptybases[i]; pr != NULL; pr = pr->next_samesize) {
+			dumpsubpage(pr);
+		}
 	}
 
 	splx(spl);
@@ -304,117 +535,72 @@ kheap_printstats(void)
 
 ////////////////////////////////////////
 
+/*
+ * Size classes. blocktype() maps a size to the smallest block that
+ * holds it with one table lookup, indexed by the size in units of the
+ * smallest block. The table is filled in on first use.
+ */
+
+#define NSIZEUNITS (LARGEST_SUBPAGE_SIZE / SMALLEST_SUBPAGE_SIZE)
+static unsigned char sizeclass[NSIZEUNITS];
+static int sizeclass_ready;
+
 static
 void
-remove_lists(struct pageref *pr, int blktype)
+sizeclass_init(void)
 {
-	struct pageref **guy;
-
-	assert(blktype>=0 && blktype<NSIZES);
-
-	for (guy = &sizebases[blktype]; *guy; guy = &(*guy)->next_samesize) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_samesize;
-			break;
-		}
-	}
-
-	for (guy = &allbase; *guy; guy = &(*guy)->next_all) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_all;
-			break;
+	unsigned i, blktype;
+
+	blktype = 0;
+	for (i=0; i<NSIZEUNITS; i++) {
+		/* sizes covered by entry i are up to (i+1) units */
+		while ((i+1)*SMALLEST_SUBPAGE_SIZE > sizes[blktype]) {
+			blktype++;
+			assert(blktype < NSIZES);
 		}
+		sizeclass[i] = blktype;
 	}
+	sizeclass_ready = 1;
 }
 
 static
 inline
 int blocktype(size_t sz)
 {
-	unsigned i;
-	for (i=0; i<NSIZES; i++) {
-		if (sz <= sizes[i]) {
-			return i;
-		}
+	if (sz == 0) {
+		sz = 1;
+	}
+
+	if (sz > LARGEST_SUBPAGE_SIZE) {
+		panic("Subpage allocator cannot handle allocation of size %lu\n", 
+		      (unsigned long)sz);
 	}
 
-	panic("Subpage allocator cannot handle allocation of size %lu\n", 
-	      (unsigned long)sz);
+	if (!sizeclass_ready) {
+		sizeclass_init();
+	}
 
-	// keep compiler happy
-	return 0;
+	return sizeclass[(sz - 1) / SMALLEST_SUBPAGE_SIZE];
 }
 
+/*
+ * Get a fresh page for BLKTYPE and thread its free list. Returns the
+ * pageref, not yet on any list, or NULL if out of memory.
+ */
 static
-void *
-subpage_kmalloc(size_t sz)
+struct pageref *
+newsubpage(unsigned blktype)
 {
-	int spl;		// saved interrupt level
-	unsigned blktype;	// index into sizes[] that we're using
-	struct pageref *pr;	// pageref for page we're allocating from
+	struct pageref *pr;	// pageref for the new page
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
 	vaddr_t fla;		// free list entry address
 	struct freelist *volatile fl;	// free list entry
-	void *retptr;		// our result
 
 	volatile int i;
 
-
-	blktype = blocktype(sz);
-	sz = sizes[blktype];
-
-	spl = splhigh();
-
-	checksubpages();
-
-	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
-
-		/* check for corruption */
-		assert(PR_BLOCKTYPE(pr) == blktype);
-		checksubpage(pr);
-
-		if (pr->nfree > 0) {
-
-		doalloc: /* comes here after getting a whole fresh page */
-
-			assert(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
-
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
-
-			if (fl != NULL) {
-				assert(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				assert(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
-			}
-			else {
-				assert(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
-			}
-
-			checksubpages();
-
-			splx(spl);
-			return retptr;
-		}
-	}
-
-	/*
-	 * No page of the right size available.
-	 * Make a new one.
-	 */
-
 	pr = allocpageref();
 	if (pr==NULL) {
 		/* Couldn't allocate accounting space for the new page. */
-		splx(spl);
 		kprintf("kmalloc: Subpage allocator couldn't get pageref\n"); 
 		return NULL;
 	}
@@ -423,7 +609,6 @@ subpage_kmalloc(size_t sz)
 	if (prpage==0) {
 		/* Out of memory. */
 		freepageref(pr);
-		splx(spl);
 		kprintf("kmalloc: Subpage allocator couldn't get a page\n"); 
 		return NULL;
 	}
@@ -431,6 +616,13 @@ subpage_kmalloc(size_t sz)
 	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
 	pr->nfree = PAGE_SIZE / sizes[blktype];
 
+	if (mappageref(pr)) {
+		free_kpages(prpage);
+		freepageref(pr);
+		kprintf("kmalloc: Subpage allocator couldn't map page\n"); 
+		return NULL;
+	}
+
 	/*
 	 * Note: fl is volatile because the MIPS toolchain we were
 	 * using in spring 2001 attempted to optimize this loop and
@@ -449,14 +641,79 @@ subpage_kmalloc(size_t sz)
 	pr->freelist_offset = fla - prpage;
 	assert(pr->freelist_offset == (pr->nfree-1)*sizes[blktype]);
 
-	pr->next_samesize = sizebases[blktype];
-	sizebases[blktype] = pr;
+	pr->next_samesize = NULL;
+	pr->prev_samesize = NULL;
 
-	pr->next_all = allbase;
-	allbase = pr;
+	return pr;
+}
 
-	/* This is kind of cheesy, but avoids duplicating the alloc code. */
-	goto doalloc;
+static
+void *
+subpage_kmalloc(size_t sz)
+{
+	int spl;		// saved interrupt level
+	unsigned blktype;	// index into sizes[] that we're using
+	struct pageref *pr;	// pageref for page we're allocating from
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *fl;	// free list entry
+	void *retptr;		// our result
+
+	blktype = blocktype(sz);
+	sz = sizes[blktype];
+
+	spl = splhigh();
+
+	checksubpages();
+
+	/* Take a partly used page first, then the spare, then a new one */
+	pr = partialbases[blktype];
+	if (pr != NULL) {
+		pr_unlink(pr);
+	}
+	else if (emptybases[blktype] != NULL) {
+		pr = emptybases[blktype];
+		pr_unlink(pr);
+	}
+	else {
+		pr = newsubpage(blktype);
+		if (pr == NULL) {
+			splx(spl);
+			return NULL;
+		}
+	}
+
+	/* check for corruption */
+	assert(PR_BLOCKTYPE(pr) == blktype);
+	assert(pr->nfree > 0);
+	checksubpage(pr);
+
+	assert(pr->freelist_offset < PAGE_SIZE);
+	prpage = PR_PAGEADDR(pr);
+	fla = prpage + pr->freelist_offset;
+	fl = (struct freelist *)fla;
+
+	retptr = fl;
+	fl = fl->next;
+	pr->nfree--;
+
+	if (fl != NULL) {
+		assert(pr->nfree > 0);
+		fla = (vaddr_t)fl;
+		assert(fla - prpage < PAGE_SIZE);
+		pr->freelist_offset = fla - prpage;
+		pr_link(&partialbases[blktype], pr);
+	}
+	else {
+		assert(pr->nfree == 0);
+		pr->freelist_offset = INVALID_OFFSET;
+		pr_link(&fullbases[blktype], pr);
+	}
+
+	checksubpages();
+
+	splx(spl);
+	return retptr;
 }
 
 static
@@ -478,25 +735,20 @@ subpage_kfree(void *ptr)
 
 	checksubpages();
 
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-
-		/* check for corruption */
-		assert(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
-
+	pr = findpageref(ptraddr);
 	if (pr==NULL) {
 		/* Not on any of our pages - not a subpage allocation */
 		splx(spl);
 		return -1;
 	}
 
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+
+	/* check for corruption */
+	assert(blktype>=0 && blktype<NSIZES);
+	checksubpage(pr);
+
 	offset = ptraddr - prpage;
 
 	/* Check for proper positioning and alignment */
@@ -526,9 +778,18 @@ subpage_kfree(void *ptr)
 	pr->nfree++;
 
 	assert(pr->nfree <= PAGE_SIZE / sizes[blktype]);
-	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
-		/* Whole page is free. */
-		remove_lists(pr, blktype);
+	pr_unlink(pr);
+
+	if (pr->nfree < PAGE_SIZE / sizes[blktype]) {
+		pr_link(&partialbases[blktype], pr);
+	}
+	else if (emptybases[blktype] == NULL) {
+		/* Whole page is free; keep it as the spare. */
+		pr_link(&emptybases[blktype], pr);
+	}
+	else {
+		/* Whole page is free and we have a spare already. */
+		unmappageref(pr);
 		free_kpages(prpage);
 		freepageref(pr);
 	}
@@ -539,12 +800,328 @@ subpage_kfree(void *ptr)
 	return 0;
 }
 
+//
+////////////////////////////////////////////////////////////
+//
+// Allocation profiler.
+//
+// When turned on (kheap_profile(1)), every kmalloc records the
+// block's address, size, call site and time in a table of live
+// blocks, and adds to per-call-site totals; kfree removes the block
+// again. What is left in the table when a test finishes is what the
+// test leaked. Call sites are return addresses; look them up in the
+// kernel image with nm or addr2line.
+//
+// Both tables live in pages obtained directly from the VM system,
+// so that tracking doesn't itself go through kmalloc. Blocks
+// allocated while profiling was off aren't in the table, and freeing
+// them is ignored. If the live table fills up, further blocks are
+// counted as dropped and not tracked.
+//
+
+struct kmblock {
+	vaddr_t kb_addr;	/* 0 if slot unused */
+	vaddr_t kb_site;
+	size_t kb_size;
+	time_t kb_secs;
+	u_int32_t kb_nsecs;
+};
+
+struct kmsite {
+	vaddr_t ks_site;	/* 0 if slot unused */
+	u_int32_t ks_allocs;	/* total allocations from here */
+	u_int32_t ks_bytes;	/* total bytes allocated from here */
+	u_int32_t ks_live;	/* blocks not yet freed */
+	u_int32_t ks_livebytes;
+};
+
+/* both must be powers of two */
+#define NKMBLOCKS 2048
+#define NKMSITES  256
+
+#define KMPROF_BYTES \
+	(NKMBLOCKS*sizeof(struct kmblock) + NKMSITES*sizeof(struct kmsite))
+#define KMPROF_PAGES ((KMPROF_BYTES + PAGE_SIZE - 1) / PAGE_SIZE)
+
+static struct kmblock *kmblocks;	/* NULL if profiling is off */
+static struct kmsite *kmsites;
+static unsigned kmprof_nlive;
+static unsigned kmprof_dropped;
+
+static
+inline
+unsigned
+kmprof_hash(vaddr_t addr)
+{
+	/* blocks are at least 16-byte aligned; drop the zero bits */
+	return (addr >> 4) * 2654435761U;
+}
+
+static
+struct kmsite *
+kmprof_site(vaddr_t site)
+{
+	unsigned i, n;
+
+	i = kmprof_hash(site) & (NKMSITES-1);
+	for (n=0; n<NKMSITES; n++) {
+		if (kmsites[i].ks_site == site) {
+			return &kmsites[i];
+		}
+		if (kmsites[i].ks_site == 0) {
+			kmsites[i].ks_site = site;
+			return &kmsites[i];
+		}
+		i = (i+1) & (NKMSITES-1);
+	}
+	return NULL;
+}
+
+static
+void
+kmprof_alloc(void *ptr, size_t sz, vaddr_t site)
+{
+	struct kmblock *kb;
+	struct kmsite *ks;
+	unsigned i;
+	int spl;
+
+	spl = splhigh();
+
+	if (kmblocks == NULL) {
+		splx(spl);
+		return;
+	}
+
+	ks = kmprof_site(site);
+	if (ks == NULL || kmprof_nlive >= NKMBLOCKS - 1) {
+		/* keep one slot empty so lookups terminate */
+		kmprof_dropped++;
+		splx(spl);
+		return;
+	}
+
+	i = kmprof_hash((vaddr_t)ptr) & (NKMBLOCKS-1);
+	while (kmblocks[i].kb_addr != 0) {
+		i = (i+1) & (NKMBLOCKS-1);
+	}
+
+	kb = &kmblocks[i];
+	kb->kb_addr = (vaddr_t)ptr;
+	kb->kb_site = site;
+	kb->kb_size = sz;
+	gettime(&kb->kb_secs, &kb->kb_nsecs);
+	kmprof_nlive++;
+
+	ks->ks_allocs++;
+	ks->ks_bytes += sz;
+	ks->ks_live++;
+	ks->ks_livebytes += sz;
+
+	splx(spl);
+}
+
+static
+void
+kmprof_free(void *ptr)
+{
+	struct kmsite *ks;
+	unsigned i, j, home;
+	int spl;
+
+	spl = splhigh();
+
+	if (kmblocks == NULL) {
+		splx(spl);
+		return;
+	}
+
+	i = kmprof_hash((vaddr_t)ptr) & (NKMBLOCKS-1);
+	while (kmblocks[i].kb_addr != (vaddr_t)ptr) {
+		if (kmblocks[i].kb_addr == 0) {
+			/* allocated before profiling started */
+			splx(spl);
+			return;
+		}
+		i = (i+1) & (NKMBLOCKS-1);
+	}
+
+	ks = kmprof_site(kmblocks[i].kb_site);
+	assert(ks != NULL && ks->ks_live > 0);
+	ks->ks_live--;
+	ks->ks_livebytes -= kmblocks[i].kb_size;
+
+	/*
+	 * Remove the entry, shifting later entries of the same probe
+	 * run back into the hole so no lookup stops short.
+	 */
+	kmblocks[i].kb_addr = 0;
+	j = i;
+	for (;;) {
+		j = (j+1) & (NKMBLOCKS-1);
+		if (kmblocks[j].kb_addr == 0) {
+			break;
+		}
+		home = kmprof_hash(kmblocks[j].kb_addr) & (NKMBLOCKS-1);
+		/* leave it alone if its home lies cyclically in (i, j] */
+		if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) {
+			continue;
+		}
+		kmblocks[i] = kmblocks[j];
+		kmblocks[j].kb_addr = 0;
+		i = j;
+	}
+	kmprof_nlive--;
+
+	splx(spl);
+}
+
+/*
+ * Turn profiling on or off. Turning it on starts over with empty
+ * tables. Returns 0 or ENOMEM.
+ */
+int
+kheap_profile(int on)
+{
+	vaddr_t pages, old;
+	int spl;
+
+	pages = 0;
+	if (on) {
+		pages = alloc_kpages(KMPROF_PAGES);
+		if (pages == 0) {
+			return ENOMEM;
+		}
+		bzero((void *)pages, KMPROF_PAGES * PAGE_SIZE);
+	}
+
+	spl = splhigh();
+	old = (vaddr_t)kmblocks;
+	if (pages != 0) {
+		kmblocks = (struct kmblock *)pages;
+		kmsites = (struct kmsite *)(pages +
+					    NKMBLOCKS*sizeof(struct kmblock));
+	}
+	else {
+		kmblocks = NULL;
+		kmsites = NULL;
+	}
+	kmprof_nlive = 0;
+	kmprof_dropped = 0;
+	splx(spl);
+
+	if (old != 0) {
+		free_kpages(old);
+	}
+	return 0;
+}
+
+/*
+ * Print the call sites with the most bytes and the most allocations.
+ */
+void
+kheap_printsites(void)
+{
+	static const char *const orders[2] = { "bytes", "allocations" };
+	char printed[NKMSITES];
+	struct kmsite *ks, *best;
+	unsigned i, n, k, bestval;
+	int spl;
+
+	spl = splhigh();
+
+	if (kmsites == NULL) {
+		splx(spl);
+		kprintf("kmalloc profiling is off\n");
+		return;
+	}
+
+	for (k=0; k<2; k++) {
+		kprintf("Top kmalloc call sites by %s:\n", orders[k]);
+		kprintf("  %-10s %8s %10s %8s %10s\n",
+			"site", "allocs", "bytes", "live", "livebytes");
+
+		bzero(printed, sizeof(printed));
+		for (n=0; n<10; n++) {
+			best = NULL;
+			bestval = 0;
+			for (i=0; i<NKMSITES; i++) {
+				ks = &kmsites[i];
+				if (ks->ks_site == 0 || printed[i]) {
+					continue;
+				}
+				if (best == NULL ||
+				    (k==0 ? ks->ks_bytes : ks->ks_allocs) >
+				    bestval) {
+					best = ks;
+					bestval = k==0 ? ks->ks_bytes
+						: ks->ks_allocs;
+				}
+			}
+			if (best == NULL) {
+				break;
+			}
+			printed[best - kmsites] = 1;
+			kprintf("  0x%08lx %8u %10u %8u %10u\n",
+				(unsigned long) best->ks_site,
+				best->ks_allocs, best->ks_bytes,
+				best->ks_live, best->ks_livebytes);
+		}
+	}
+
+	kprintf("%u blocks live, %u allocations not tracked\n",
+		kmprof_nlive, kmprof_dropped);
+
+	splx(spl);
+}
+
+/*
+ * Print every block allocated since profiling was turned on that
+ * hasn't been freed.
+ */
+void
+kheap_printlive(void)
+{
+	struct kmblock *kb;
+	unsigned i;
+	int spl;
+
+	spl = splhigh();
+
+	if (kmblocks == NULL) {
+		splx(spl);
+		kprintf("kmalloc profiling is off\n");
+		return;
+	}
+
+	kprintf("Live kmalloc blocks:\n");
+	kprintf("  %-10s %-10s %6s %s\n", "addr", "site", "size", "time");
+	for (i=0; i<NKMBLOCKS; i++) {
+		kb = &kmblocks[i];
+		if (kb->kb_addr == 0) {
+			continue;
+		}
+		kprintf("  0x%08lx 0x%08lx %6lu %lu.%09lu\n",
+			(unsigned long) kb->kb_addr,
+			(unsigned long) kb->kb_site,
+			(unsigned long) kb->kb_size,
+			(unsigned long) kb->kb_secs,
+			(unsigned long) kb->kb_nsecs);
+	}
+	kprintf("%u blocks live, %u allocations not tracked\n",
+		kmprof_nlive, kmprof_dropped);
+
+	splx(spl);
+}
+
 //
 ////////////////////////////////////////////////////////////
 
 void *
 kmalloc(size_t sz)
 {
+	void *ptr;
+
 	if (sz>=LARGEST_SUBPAGE_SIZE) {
 		unsigned long npages;
 		vaddr_t address;
@@ -556,23 +1133,38 @@ kmalloc(size_t sz)
 			return NULL;
 		}
 
-		return (void *)address;
+		ptr = (void *)address;
+	}
+	else {
+		ptr = subpage_kmalloc(sz);
+		if (ptr == NULL) {
+			return NULL;
+		}
+	}
+
+	if (kmblocks != NULL) {
+		kmprof_alloc(ptr, sz, (vaddr_t)__builtin_return_address(0));
 	}
 
-	return subpage_kmalloc(sz);
+	return ptr;
 }
 
 void
 kfree(void *ptr)
 {
+	if (ptr == NULL) {
+		return;
+	}
+
+	if (kmblocks != NULL) {
+		kmprof_free(ptr);
+	}
+
 	/*
 	 * Try subpage first; if that fails, assume it's a big allocation.
 	 */
-	if (ptr == NULL) {
-		return;
-	} else if (subpage_kfree(ptr)) {
+	if (subpage_kfree(ptr)) {
 		assert((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
 }
-
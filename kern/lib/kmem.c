@@ -0,0 +1,328 @@
+/*
+ * Object cache allocator.
+ * See kmem.h for more information.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <vm.h>
+#include <machine/spl.h>
+#include <kmem.h>
+
+/*
+ * Every slab is one page. The page starts with a struct kmem_slab,
+ * followed by the stack of free object indices, followed by the
+ * objects themselves. Keeping the free list outside the objects is
+ * what lets objects keep their constructed state while free.
+ *
+ * Because slabs are page-aligned, the slab an object belongs to is
+ * found by masking the object's address.
+ */
+
+#define KMEM_ALIGN  8
+
+struct kmem_slab {
+	struct kmem_cache *sl_cache;
+	struct kmem_slab *sl_next;	/* partial list linkage */
+	struct kmem_slab **sl_prevp;
+	u_int16_t sl_nfree;
+	u_int16_t sl_pad;
+};
+
+#define SL_FREESTACK(sl) ((u_int16_t *)((sl) + 1))
+#define SL_OBJ(kc, sl, i) \
+	((void *)((vaddr_t)(sl) + (kc)->kc_objoff + (i)*(kc)->kc_size))
+#define OBJ_SLAB(obj)    ((struct kmem_slab *)((vaddr_t)(obj) & PAGE_FRAME))
+
+struct kmem_cache {
+	const char *kc_name;
+	size_t kc_size;			/* object size, rounded up */
+	void (*kc_ctor)(void *);
+	unsigned kc_perslab;		/* objects per page */
+	vaddr_t kc_objoff;		/* offset of first object in page */
+
+	struct kmem_slab *kc_partial;	/* slabs with free objects */
+	unsigned kc_nslabs;		/* pages held */
+	unsigned kc_nempty;		/* pages with nothing allocated */
+	unsigned kc_inuse;		/* objects handed out */
+	unsigned long kc_nallocs;	/* total allocations, for stats */
+
+	struct kmem_cache *kc_next;	/* list of all caches */
+};
+
+/* All caches, for kmem_printstats. */
+static struct kmem_cache *allcaches;
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size, void (*ctor)(void *))
+{
+	struct kmem_cache *kc;
+	vaddr_t hdr;
+	int spl;
+
+	kc = kmalloc(sizeof(struct kmem_cache));
+	if (kc == NULL) {
+		return NULL;
+	}
+
+	size = ROUNDUP(size, KMEM_ALIGN);
+
+	/*
+	 * Each object costs its size plus one free stack slot. Work out
+	 * how many fit, then back off if rounding the object area up to
+	 * the alignment pushed the last one off the end of the page.
+	 */
+	kc->kc_perslab = (PAGE_SIZE - sizeof(struct kmem_slab)) /
+		(size + sizeof(u_int16_t));
+	for (;;) {
+		hdr = sizeof(struct kmem_slab) +
+			kc->kc_perslab * sizeof(u_int16_t);
+		hdr = ROUNDUP(hdr, KMEM_ALIGN);
+		if (hdr + kc->kc_perslab * size <= PAGE_SIZE) {
+			break;
+		}
+		kc->kc_perslab--;
+	}
+
+	if (kc->kc_perslab == 0) {
+		panic("kmem_cache_create: %s: objects of size %lu too large\n",
+		      name, (unsigned long) size);
+	}
+
+	kc->kc_name = name;
+	kc->kc_size = size;
+	kc->kc_ctor = ctor;
+	kc->kc_objoff = hdr;
+	kc->kc_partial = NULL;
+	kc->kc_nslabs = 0;
+	kc->kc_nempty = 0;
+	kc->kc_inuse = 0;
+	kc->kc_nallocs = 0;
+
+	spl = splhigh();
+	kc->kc_next = allcaches;
+	allcaches = kc;
+	splx(spl);
+
+	return kc;
+}
+
+/*
+ * Slab list handling. Interrupts must be off.
+ */
+static
+void
+slab_link(struct kmem_cache *kc, struct kmem_slab *sl)
+{
+	sl->sl_next = kc->kc_partial;
+	if (sl->sl_next != NULL) {
+		sl->sl_next->sl_prevp = &sl->sl_next;
+	}
+	sl->sl_prevp = &kc->kc_partial;
+	kc->kc_partial = sl;
+}
+
+static
+void
+slab_unlink(struct kmem_slab *sl)
+{
+	*sl->sl_prevp = sl->sl_next;
+	if (sl->sl_next != NULL) {
+		sl->sl_next->sl_prevp = sl->sl_prevp;
+	}
+	sl->sl_next = NULL;
+	sl->sl_prevp = NULL;
+}
+
+/*
+ * Get a fresh page, construct every object on it, and put it on the
+ * partial list.
+ */
+static
+struct kmem_slab *
+slab_create(struct kmem_cache *kc)
+{
+	struct kmem_slab *sl;
+	u_int16_t *stk;
+	vaddr_t page;
+	unsigned i;
+
+	assert(curspl>0);
+
+	page = alloc_kpages(1);
+	if (page == 0) {
+		return NULL;
+	}
+
+	sl = (struct kmem_slab *)page;
+	sl->sl_cache = kc;
+	sl->sl_nfree = kc->kc_perslab;
+
+	/* Lowest index on top, so objects are handed out in address order */
+	stk = SL_FREESTACK(sl);
+	for (i=0; i<kc->kc_perslab; i++) {
+		stk[i] = kc->kc_perslab - 1 - i;
+	}
+
+	if (kc->kc_ctor != NULL) {
+		for (i=0; i<kc->kc_perslab; i++) {
+			kc->kc_ctor(SL_OBJ(kc, sl, i));
+		}
+	}
+
+	kc->kc_nslabs++;
+	kc->kc_nempty++;
+	slab_link(kc, sl);
+
+	return sl;
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct kmem_slab *sl;
+	void *obj;
+	int spl;
+
+	assert(kc != NULL);
+
+	spl = splhigh();
+
+	sl = kc->kc_partial;
+	if (sl == NULL) {
+		sl = slab_create(kc);
+		if (sl == NULL) {
+			splx(spl);
+			return NULL;
+		}
+	}
+
+	assert(sl->sl_cache == kc);
+	assert(sl->sl_nfree > 0);
+
+	if (sl->sl_nfree == kc->kc_perslab) {
+		assert(kc->kc_nempty > 0);
+		kc->kc_nempty--;
+	}
+
+	sl->sl_nfree--;
+	obj = SL_OBJ(kc, sl, SL_FREESTACK(sl)[sl->sl_nfree]);
+
+	if (sl->sl_nfree == 0) {
+		/* Full; nothing more to hand out from here */
+		slab_unlink(sl);
+	}
+
+	kc->kc_inuse++;
+	kc->kc_nallocs++;
+
+	splx(spl);
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_slab *sl;
+	vaddr_t offset;
+	int spl;
+
+	if (obj == NULL) {
+		return;
+	}
+
+	sl = OBJ_SLAB(obj);
+	offset = (vaddr_t)obj - (vaddr_t)sl - kc->kc_objoff;
+
+	/* Check for freeing into the wrong cache or a bad pointer */
+	if (sl->sl_cache != kc || offset % kc->kc_size != 0 ||
+	    offset / kc->kc_size >= kc->kc_perslab) {
+		panic("kmem_cache_free: %s: invalid object %p\n",
+		      kc->kc_name, obj);
+	}
+
+	spl = splhigh();
+
+	assert(sl->sl_nfree < kc->kc_perslab);
+	assert(kc->kc_inuse > 0);
+
+	SL_FREESTACK(sl)[sl->sl_nfree] = offset / kc->kc_size;
+	sl->sl_nfree++;
+	kc->kc_inuse--;
+
+	if (sl->sl_nfree == 1) {
+		/* Was full; can hand out objects from here again */
+		slab_link(kc, sl);
+	}
+
+	if (sl->sl_nfree == kc->kc_perslab) {
+		if (kc->kc_nempty > 0) {
+			/* Already have a spare page; give this one back */
+			slab_unlink(sl);
+			kc->kc_nslabs--;
+			free_kpages((vaddr_t)sl);
+		}
+		else {
+			kc->kc_nempty++;
+		}
+	}
+
+	splx(spl);
+}
+
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	struct kmem_cache **guy;
+	struct kmem_slab *sl;
+	int spl;
+
+	spl = splhigh();
+
+	if (kc->kc_inuse > 0) {
+		panic("kmem_cache_destroy: %s: %u objects still in use\n",
+		      kc->kc_name, kc->kc_inuse);
+	}
+
+	/* With nothing in use, every slab is on the partial list */
+	while (kc->kc_partial != NULL) {
+		sl = kc->kc_partial;
+		slab_unlink(sl);
+		kc->kc_nslabs--;
+		free_kpages((vaddr_t)sl);
+	}
+	assert(kc->kc_nslabs == 0);
+
+	for (guy = &allcaches; *guy; guy = &(*guy)->kc_next) {
+		if (*guy == kc) {
+			*guy = kc->kc_next;
+			break;
+		}
+	}
+
+	splx(spl);
+
+	kfree(kc);
+}
+
+void
+kmem_printstats(void)
+{
+	struct kmem_cache *kc;
+
+	/* print the whole thing with interrupts off */
+	int spl = splhigh();
+
+	kprintf("Object caches:\n");
+	kprintf("  %-20s %6s %6s %6s %6s %10s\n",
+		"name", "size", "inuse", "slabs", "empty", "allocs");
+
+	for (kc = allcaches; kc != NULL; kc = kc->kc_next) {
+		kprintf("  %-20s %6lu %6u %6u %6u %10lu\n",
+			kc->kc_name, (unsigned long) kc->kc_size,
+			kc->kc_inuse, kc->kc_nslabs, kc->kc_nempty,
+			kc->kc_nallocs);
+	}
+
+	splx(spl);
+}
@@ -0,0 +1,139 @@
+/*
+ * Intrusive doubly linked list.
+ * See list.h for more information.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <list.h>
+
+void
+list_init(struct list *l)
+{
+	l->l_head.ln_prev = &l->l_head;
+	l->l_head.ln_next = &l->l_head;
+	l->l_head.ln_self = NULL;
+	l->l_count = 0;
+}
+
+void
+listnode_init(struct listnode *ln, void *self)
+{
+	ln->ln_prev = NULL;
+	ln->ln_next = NULL;
+	ln->ln_self = self;
+}
+
+int
+list_isempty(const struct list *l)
+{
+	return l->l_count == 0;
+}
+
+unsigned
+list_count(const struct list *l)
+{
+	return l->l_count;
+}
+
+/*
+ * Put LN in between PREV and PREV's successor.
+ */
+static
+void
+list_insertafter(struct list *l, struct listnode *prev, struct listnode *ln)
+{
+	/* catch adding a node that's already on a list */
+	assert(ln->ln_prev == NULL && ln->ln_next == NULL);
+
+	ln->ln_prev = prev;
+	ln->ln_next = prev->ln_next;
+	prev->ln_next->ln_prev = ln;
+	prev->ln_next = ln;
+	l->l_count++;
+}
+
+void
+list_addhead(struct list *l, struct listnode *ln)
+{
+	list_insertafter(l, &l->l_head, ln);
+}
+
+void
+list_addtail(struct list *l, struct listnode *ln)
+{
+	list_insertafter(l, l->l_head.ln_prev, ln);
+}
+
+void
+list_remove(struct list *l, struct listnode *ln)
+{
+	assert(ln != &l->l_head);
+	assert(ln->ln_prev != NULL && ln->ln_next != NULL);
+	assert(l->l_count > 0);
+
+	ln->ln_prev->ln_next = ln->ln_next;
+	ln->ln_next->ln_prev = ln->ln_prev;
+	ln->ln_prev = NULL;
+	ln->ln_next = NULL;
+	l->l_count--;
+}
+
+void *
+list_remhead(struct list *l)
+{
+	struct listnode *ln;
+
+	if (l->l_count == 0) {
+		return NULL;
+	}
+	ln = l->l_head.ln_next;
+	list_remove(l, ln);
+	return ln->ln_self;
+}
+
+void *
+list_head(const struct list *l)
+{
+	if (l->l_count == 0) {
+		return NULL;
+	}
+	return l->l_head.ln_next->ln_self;
+}
+
+void
+list_move(struct list *dst, struct list *src)
+{
+	assert(dst->l_count == 0);
+
+	if (src->l_count == 0) {
+		return;
+	}
+
+	/* splice the nodes onto dst's sentinel */
+	dst->l_head.ln_next = src->l_head.ln_next;
+	dst->l_head.ln_prev = src->l_head.ln_prev;
+	dst->l_head.ln_next->ln_prev = &dst->l_head;
+	dst->l_head.ln_prev->ln_next = &dst->l_head;
+	dst->l_count = src->l_count;
+
+	list_init(src);
+}
+
+struct listnode *
+list_first(const struct list *l)
+{
+	if (l->l_count == 0) {
+		return NULL;
+	}
+	return l->l_head.ln_next;
+}
+
+struct listnode *
+list_next(const struct list *l, const struct listnode *ln)
+{
+	if (ln->ln_next == &l->l_head) {
+		return NULL;
+	}
+	return ln->ln_next;
+}
@@ -19,6 +19,8 @@
 #include <proc.h>
 #include <file.h>
 #include <pagetable.h>
+#include <workqueue.h>
+#include "opt-lockstat.h"
 
 /*
  * These two pieces of data are maintained by the makefiles and build system.
@@ -78,10 +80,15 @@ boot(void)
 	thread_bootstrap();
 	vfs_bootstrap();
 	dev_bootstrap();
+#if OPT_LOCKSTAT
+	lockstat_bootstrap();
+#endif
 	pagetable_bootstrap();
 	kprintf_bootstrap();
 	proc_bootstrap();
 	file_bootstrap();
+	workqueue_bootstrap();
+	syscall_bootstrap();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
@@ -7,9 +7,12 @@
 #include <kern/unistd.h>
 #include <kern/limits.h>
 #include <lib.h>
+#include <kmem.h>
 #include <clock.h>
 #include <thread.h>
 #include <curthread.h>
+#include <synch.h>
+#include <scheduler.h>
 #include <syscall.h>
 #include <uio.h>
 #include <vfs.h>
@@ -21,6 +24,7 @@
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-lockstat.h"
 
 #define _PATH_SHELL "/bin/sh"
 
@@ -60,7 +64,7 @@ cmd_progthread(void *ptr, unsigned long nargs)
 {
 	char **args = ptr;
 	char progname[128];
-	struct array *newft;
+	struct fdtable *newft;
 	pid_t newpid;
 	int result;
 
@@ -76,15 +80,16 @@ cmd_progthread(void *ptr, unsigned long nargs)
 	strcpy(progname, args[0]);
 
 	/* cheesy hack to get exit working */
-	newpid = newprocess(1);
+	newpid = newprocess(PID_MIN);
 	if (newpid < 0)
 		panic("cmd_progthread: allocating new process %s", strerror(newpid));
 	curthread->t_pid = newpid;
+	curthread->t_proc = getprocess(newpid);
 
 	// no pagetable corruption here
 	
 	/* set up filetable */
-	newft = copyfiletable(1);
+	newft = copyfiletable(PID_MIN);
 	if (newft==NULL)
 		panic("cmd_progthread: initializing filetable for child\n");
 
@@ -94,6 +99,11 @@ cmd_progthread(void *ptr, unsigned long nargs)
 	if (result) {
 		kprintf("Running program %s failed: %s\n", args[0],
 			strerror(result));
+		lock_acquire(procexit_lock);
+		freeprocess(getcurprocess());
+		lock_release(procexit_lock);
+		curthread->t_pid = PID_MIN;
+		curthread->t_proc = getprocess(PID_MIN);
 		return;
 	}
 
@@ -376,10 +386,174 @@ cmd_kheapstats(int nargs, char **args)
 	(void)args;
 
 	kheap_printstats();
+	kmem_printstats();
 	
 	return 0;
 }
 
+/*
+ * Command for showing scheduler statistics, setting the quantum and
+ * choosing the scheduler.
+ */
+static
+int
+cmd_sched(int nargs, char **args)
+{
+	int result;
+
+	if (nargs > 2) {
+		kprintf("Usage: sched [quantum-ticks|mlfq|stride]\n");
+		return EINVAL;
+	}
+
+	if (nargs == 2 && !strcmp(args[1], "mlfq")) {
+		scheduler_setmode(SCHED_MLFQ);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "stride")) {
+		scheduler_setmode(SCHED_STRIDE);
+	}
+	else if (nargs == 2) {
+		result = scheduler_setquantum(atoi(args[1]));
+		if (result) {
+			kprintf("sched: quantum must be 1 to %d ticks\n", HZ);
+			return result;
+		}
+	}
+
+	scheduler_printstats();
+	return 0;
+}
+
+/*
+ * Command for scheduler utilisation and latency statistics.
+ */
+static
+int
+cmd_schedlat(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		scheduler_setlatency(1);
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "off")) {
+		scheduler_setlatency(0);
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		scheduler_resetstats();
+		return 0;
+	}
+	if (nargs == 1) {
+		scheduler_printlatency();
+		return 0;
+	}
+
+	kprintf("Usage: schedlat [on|off|reset]\n");
+	return EINVAL;
+}
+
+/*
+ * Command for printing system call statistics.
+ */
+static
+int
+cmd_syscalls(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		syscall_resetstats();
+		return 0;
+	}
+	if (nargs == 1) {
+		syscall_printstats();
+		return 0;
+	}
+
+	kprintf("Usage: syscalls [reset]\n");
+	return EINVAL;
+}
+
+/*
+ * Command for setting a process's stride scheduling tickets.
+ */
+static
+int
+cmd_tickets(int nargs, char **args)
+{
+	int tickets;
+
+	if (nargs != 3) {
+		kprintf("Usage: tickets pid tickets\n");
+		return EINVAL;
+	}
+
+	tickets = atoi(args[2]);
+	if (tickets < 0 || tickets > STRIDE_MAXTICKETS) {
+		kprintf("tickets: tickets must be 0 to %d\n",
+			STRIDE_MAXTICKETS);
+		return EINVAL;
+	}
+
+	if (proc_settickets(atoi(args[1]), tickets) < 0) {
+		kprintf("tickets: no such process %s\n", args[1]);
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * Command for printing lock contention statistics.
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+#if OPT_LOCKSTAT
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lockstat_reset();
+		return 0;
+	}
+	if (nargs == 1) {
+		return lockstat_dump();
+	}
+
+	kprintf("Usage: lockstat [reset]\n");
+	return EINVAL;
+#else
+	(void)nargs;
+	(void)args;
+
+	kprintf("lockstat: kernel not built with the lockstat option\n");
+	return EUNIMP;
+#endif
+}
+
+/*
+ * Command for kmalloc profiling.
+ */
+static
+int
+cmd_kmprof(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		return kheap_profile(1);
+	}
+	if (nargs == 2 && !strcmp(args[1], "off")) {
+		return kheap_profile(0);
+	}
+	if (nargs == 2 && !strcmp(args[1], "live")) {
+		kheap_printlive();
+		return 0;
+	}
+	if (nargs == 1) {
+		kheap_printsites();
+		return 0;
+	}
+
+	kprintf("Usage: kmprof [on|off|live]\n");
+	return EINVAL;
+}
+
 static
 int
 cmd_pagestats(int nargs, char **args)
@@ -392,6 +566,52 @@ cmd_pagestats(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_memstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	proc_memdump();
+
+	return 0;
+}
+
+/*
+ * Command for setting a resident-set cap, in frames. "default" sets
+ * the cap given to processes created from now on. 0 removes the cap.
+ */
+static
+int
+cmd_rsslimit(int nargs, char **args)
+{
+	int limit;
+
+	if (nargs != 3) {
+		kprintf("Usage: rsslimit pid|default frames\n");
+		return EINVAL;
+	}
+
+	limit = atoi(args[2]);
+	if (limit < 0) {
+		kprintf("rsslimit: frames must not be negative\n");
+		return EINVAL;
+	}
+
+	if (!strcmp(args[1], "default")) {
+		proc_rsslimit = limit;
+		return 0;
+	}
+
+	if (proc_setrsslimit(atoi(args[1]), limit) < 0) {
+		kprintf("rsslimit: no such process %s\n", args[1]);
+		return EINVAL;
+	}
+
+	return 0;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -452,6 +672,7 @@ static const char *testmenu[] = {
 	"[kt]  Kprintf test		     ",
 	"[bt]  Bitmap test                   ",
 	"[qt]  Queue test                    ",
+	"[lt]  List test                     ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
 	"[tt1] Thread test 1                 ",
@@ -463,6 +684,9 @@ static const char *testmenu[] = {
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[sy4] Rwlock test                   ",
+	"[stride] Stride scheduler share test",
+	"[wq]  Workqueue test                ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress        (4)     ",
 	"[fs3] FS write stress       (4)     ",
@@ -498,7 +722,15 @@ static const char *mainmenu[] = {
 	"[1b] Stoplight                      ",
 #endif
 	"[kh] Kernel heap stats              ",
+	"[kmprof] kmalloc profiling          ",
+	"[lockstat] Lock contention stats    ",
 	"[ps] Pagetable stats                ",
+	"[mem] Process memory stats          ",
+	"[rsslimit] Set resident-set cap     ",
+	"[sched] Scheduler stats/quantum     ",
+	"[schedlat] Scheduler latency stats  ",
+	"[syscalls] System call stats        ",
+	"[tickets] Set stride tickets        ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -554,13 +786,22 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "kmprof",	cmd_kmprof },
+	{ "lockstat",	cmd_lockstat },
 	{ "ps",		cmd_pagestats },
+	{ "mem",	cmd_memstats },
+	{ "rsslimit",	cmd_rsslimit },
+	{ "sched",	cmd_sched },
+	{ "schedlat",	cmd_schedlat },
+	{ "syscalls",	cmd_syscalls },
+	{ "tickets",	cmd_tickets },
 
 	/* base system tests */
 	{ "at",		arraytest },
 	{ "kt",		kprintftest },
 	{ "bt",		bitmaptest },
 	{ "qt",		queuetest },
+	{ "lt",		listtest },
 	{ "km1",	malloctest },
 	{ "km2",	mallocstress },
 #if OPT_NET
@@ -574,6 +815,9 @@ static struct {
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+	{ "sy4",	rwlocktest },
+	{ "stride",	stridetest },
+	{ "wq",		wqtest },
 
 	/* file system assignment tests */
 	{ "fs1",	fstest },
@@ -2,47 +2,139 @@
 #include <lib.h>
 #include <kern/errno.h>
 #include <synch.h>
+#include <machine/spl.h>
 #include <thread.h>
 #include <curthread.h>
+#include <scheduler.h>
 #include <file.h>
 #include <proc.h>
 
+u_int32_t proc_rsslimit;
+
+/* number of processes holding more frames than their cap */
+static int overrsscount;
+
+static
+int
+isover(struct process *proc)
+{
+	return proc->rsslimit && (proc->rss > proc->rsslimit);
+}
+
+/* the process table, hashed on pid. Changed only with proctable_lock
+ * held exclusive and interrupts off, so it can also be searched with
+ * just interrupts off */
+#define PROC_HASHSIZE 64
+#define PROCHASH(pid) ((pid) & (PROC_HASHSIZE-1))
+static struct list proctable[PROC_HASHSIZE];
+static int proctable_ready;
+
+/* free pids, a ring buffer in the order they were freed. Under
+ * proctable_lock held exclusive */
+static u_int16_t *pidfree;
+static unsigned pidfree_head, pidfree_count;
+
+/* returns a free pid, or 0 if there are none */
+static
+pid_t
+pid_alloc(void)
+{
+	pid_t pid;
+
+	if (pidfree_count==0)
+		return 0;
+
+	pid = pidfree[pidfree_head];
+	pidfree_head = (pidfree_head + 1) % PID_MAX;
+	pidfree_count--;
+	return pid;
+}
+
+static
+void
+pid_release(pid_t pid)
+{
+	assert(pid >= PID_MIN && pid < PID_MAX);
+	assert(pidfree_count < PID_MAX);
+
+	pidfree[(pidfree_head + pidfree_count) % PID_MAX] = pid;
+	pidfree_count++;
+}
+
 void
 proc_bootstrap(void)
 {
 	pid_t initpid;
+	int i;
 
-	proctable = array_create();	
-	proctable_lock = lock_create("proctable_lock");
+	for (i=0; i<PROC_HASHSIZE; i++)
+		list_init(&proctable[i]);
+
+	pidfree = kmalloc(PID_MAX * sizeof(u_int16_t));
+	if (pidfree==NULL)
+		panic("proc_bootstrap: failed to allocate pid list\n");
+	for (i=PID_MIN; i<PID_MAX; i++)
+		pid_release(i);
+
+	proctable_ready = 1;
+
+	proctable_lock = rwlock_create("proctable_lock");
 	if (proctable_lock==NULL)
 		panic("proc_bootstrap: failed to initialize proctable_lock\n");
+
+	procexit_lock = lock_create("procexit_lock");
+	if (procexit_lock==NULL)
+		panic("proc_bootstrap: failed to initialize procexit_lock\n");
 	
-	/* should always be zero */
-	initpid = newprocess(1);
-	assert(initpid==1);
+	/* the first pid handed out is PID_MIN */
+	initpid = newprocess(PID_MIN);
+	assert(initpid==PID_MIN);
 
 	curthread->t_pid = initpid;
+	curthread->t_proc = getprocess(initpid);
 
 	kprintf("proctable initialized\n");
 }
 
+/* looks pid up in the process table without proctable_lock, the VM
+ * system can't take proctable_lock since it's held across kmalloc.
+ * Only safe with interrupts off, the table is changed atomically */
+static
 struct process *
-getprocess(pid_t pid)
+lookupprocess(pid_t pid)
 {
+	struct list *chain;
+	struct listnode *ln;
 	struct process *proc;
 
-	lock_acquire(proctable_lock);
+	assert(curspl>0);
 
-	pid -= 1;
+	if (!proctable_ready || (pid < PID_MIN) || (pid >= PID_MAX))
+		return NULL;
 
-	if ((pid > array_getnum(proctable)) || (pid < 0))
-		proc = NULL;
-	else 
+	chain = &proctable[PROCHASH(pid)];
+	for (ln = list_first(chain); ln != NULL; ln = list_next(chain, ln))
 	{
-		proc = (struct process *) array_getguy(proctable, (int) pid);
+		proc = ln->ln_self;
+		if (proc->pid == pid)
+			return proc;
 	}
+	return NULL;
+}
 
-	lock_release(proctable_lock);
+struct process *
+getprocess(pid_t pid)
+{
+	struct process *proc;
+	int spl;
+
+	rwlock_acquire_read(proctable_lock);
+
+	spl = splhigh();
+	proc = lookupprocess(pid);
+	splx(spl);
+
+	rwlock_release_read(proctable_lock);
 
 	return proc;
 }
@@ -50,12 +142,9 @@ getprocess(pid_t pid)
 struct process *
 getcurprocess()
 {
-	pid_t curpid;
 	struct process *proc;
 
-	curpid = curthread->t_pid;
-
-	proc = getprocess(curpid);
+	proc = curthread->t_proc;
 	if (proc==NULL)	
 		panic("getcurprocess: kernel thread with invalid process id\n");
 
@@ -65,9 +154,10 @@ getcurprocess()
 pid_t
 newprocess(pid_t parent)
 {
-	struct process *newproc;
+	struct process *newproc, *parentproc;
 	pid_t newpid;
 	struct cv *newcv;
+	int spl;
 
 	newproc = (struct process *) kmalloc(sizeof(struct process));
 	if (newproc==NULL)
@@ -80,39 +170,307 @@ newprocess(pid_t parent)
 		return (pid_t) -ENOMEM;
 	}
 
+	listnode_init(&newproc->hashnode, newproc);
+	listnode_init(&newproc->sibnode, newproc);
+	list_init(&newproc->children);
 	newproc->filetable = NULL;
 	newproc->parentpid = parent;
 	newproc->childexit = newcv;
 	newproc->exited = 0;
+	newproc->exitcode = 0;
+	newproc->rss = 0;
+	newproc->swapped = 0;
+	newproc->rsslimit = proc_rsslimit;
+	newproc->tickets = 0;
 
-	lock_acquire(proctable_lock);
+	lock_acquire(procexit_lock);
+	rwlock_acquire_write(proctable_lock);
 
-	newpid = array_getnum(proctable);	
-	array_add(proctable, newproc);
+	newpid = pid_alloc();
+	if (newpid==0)
+	{
+		rwlock_release_write(proctable_lock);
+		lock_release(procexit_lock);
+		cv_destroy(newcv);
+		kfree(newproc);
+		return (pid_t) -EAGAIN;
+	}
+	newproc->pid = newpid;
 
-	lock_release(proctable_lock);
+	/* interrupts off so lookupprocess never sees the chain mid-change */
+	spl = splhigh();
+	parentproc = lookupprocess(parent);
+	if (parentproc != NULL)
+	{
+		newproc->tickets = parentproc->tickets;
+		list_addtail(&parentproc->children, &newproc->sibnode);
+	}
+	else
+	{
+		/* only the kernel's own process has no parent */
+		newproc->parentpid = 0;
+	}
+	list_addtail(&proctable[PROCHASH(newpid)], &newproc->hashnode);
+	splx(spl);
+
+	rwlock_release_write(proctable_lock);
+	lock_release(procexit_lock);
+
+	return newpid;
+}
+
+void
+freeprocess(struct process *proc)
+{
+	struct process *parentproc;
+	int spl;
+
+	assert(lock_do_i_hold(procexit_lock));
+	assert(list_isempty(&proc->children));
+
+	rwlock_acquire_write(proctable_lock);
+
+	spl = splhigh();
+	if (proc->parentpid != 0)
+	{
+		parentproc = lookupprocess(proc->parentpid);
+		assert(parentproc != NULL);
+		list_remove(&parentproc->children, &proc->sibnode);
+	}
+	list_remove(&proctable[PROCHASH(proc->pid)], &proc->hashnode);
+	overrsscount -= isover(proc);
+	splx(spl);
+
+	pid_release(proc->pid);
 
-	return newpid+1;
+	rwlock_release_write(proctable_lock);
+
+	/* normally already closed by proc_exit */
+	if (proc->filetable != NULL)
+		filetable_destroy(proc->filetable);
+
+	cv_destroy(proc->childexit);
+	kfree(proc);
 }
 
-/* If being called by an exiting child, this should only be called
- * once done fiddling with the process table entry */
+/* removes the exited children of proc, which nobody will now reap,
+ * and orphans the rest. procexit_lock must be held */
+static
 void
-ringparent()
+orphanchildren(struct process *proc)
+{
+	struct process *child;
+
+	assert(lock_do_i_hold(procexit_lock));
+
+	while (!list_isempty(&proc->children))
+	{
+		child = list_remhead(&proc->children);
+		child->parentpid = 0;
+		if (child->exited)
+			freeprocess(child);
+	}
+}
+
+void
+proc_exit(int exitcode)
 {
 	struct process *proc;
 	struct process *parentproc;
 
 	proc = getcurprocess();
-	
-	parentproc = getprocess(proc->parentpid);
 
-	/* If the parent has left and we've been orphaned, just return */
-	/* it's actually more likely that we'll crash-and-burn from a 
-	 * NULL pointer dereference if the parent has left */
+	/* closing files can sleep, so not under procexit_lock */
+	if (proc->filetable != NULL)
+	{
+		filetable_destroy(proc->filetable);
+		proc->filetable = NULL;
+	}
+
+	lock_acquire(procexit_lock);
+
+	orphanchildren(proc);
+
+	proc->exitcode = exitcode;
+	proc->exited = 1;
+
+	parentproc = NULL;
+	if (proc->parentpid != 0 && proc->parentpid != PID_MIN)
+		parentproc = getprocess(proc->parentpid);
+
+	/* If we've been orphaned, or the kernel launched us, nobody will
+	 * wait for us */
 	if (parentproc==NULL)
+		freeprocess(proc);
+	else
+		cv_broadcast(parentproc->childexit, procexit_lock);
+
+	lock_release(procexit_lock);
+
+	/* proc may be gone now, don't leave it lying around */
+	curthread->t_proc = NULL;
+}
+
+void
+proc_memaccount(pid_t pid, int rssdelta, int swapdelta)
+{
+	struct process *proc;
+	int wasover;
+	int spl;
+
+	spl = splhigh();
+
+	proc = lookupprocess(pid);
+	if (proc==NULL)
+	{
+		splx(spl);
 		return;
+	}
+
+	wasover = isover(proc);
+
+	assert(rssdelta >= 0 || proc->rss >= (u_int32_t) -rssdelta);
+	proc->rss += rssdelta;
+
+	/* swap entries can be dropped wholesale by invalidateswapentries */
+	if (swapdelta < 0 && proc->swapped < (u_int32_t) -swapdelta)
+		proc->swapped = 0;
+	else
+		proc->swapped += swapdelta;
+
+	overrsscount += isover(proc) - wasover;
+
+	splx(spl);
+}
+
+int
+proc_atrsslimit(pid_t pid)
+{
+	struct process *proc;
+	int ret;
+	int spl;
+
+	spl = splhigh();
+	proc = lookupprocess(pid);
+	ret = (proc!=NULL) && proc->rsslimit && (proc->rss >= proc->rsslimit);
+	splx(spl);
+
+	return ret;
+}
+
+int
+proc_overrsslimit(pid_t pid)
+{
+	struct process *proc;
+	int ret;
+	int spl;
+
+	spl = splhigh();
+	proc = lookupprocess(pid);
+	ret = (proc!=NULL) && isover(proc);
+	splx(spl);
+
+	return ret;
+}
+
+int
+proc_overrsscount(void)
+{
+	return overrsscount;
+}
+
+int
+proc_setrsslimit(pid_t pid, u_int32_t limit)
+{
+	struct process *proc;
+	int wasover;
+	int spl;
+
+	spl = splhigh();
+	proc = lookupprocess(pid);
+	if (proc==NULL)
+	{
+		splx(spl);
+		return -EINVAL;
+	}
+
+	wasover = isover(proc);
+	proc->rsslimit = limit;
+	overrsscount += isover(proc) - wasover;
+
+	splx(spl);
+	return 0;
+}
+
+u_int32_t
+proc_gettickets(pid_t pid)
+{
+	struct process *proc;
+	u_int32_t tickets;
+	int spl;
+
+	spl = splhigh();
+	proc = lookupprocess(pid);
+	tickets = proc==NULL ? 0 : proc->tickets;
+	splx(spl);
+
+	return tickets;
+}
+
+int
+proc_settickets(pid_t pid, u_int32_t tickets)
+{
+	struct process *proc;
+	int spl;
+
+	if (tickets > STRIDE_MAXTICKETS)
+		return -EINVAL;
+
+	spl = splhigh();
+	proc = lookupprocess(pid);
+	if (proc==NULL)
+	{
+		splx(spl);
+		return -EINVAL;
+	}
+
+	proc->tickets = tickets;
+
+	splx(spl);
+	return 0;
+}
+
+void
+proc_memdump(void)
+{
+	struct process *proc;
+	struct listnode *ln;
+	int i;
+	int spl;
+
+	/* print the whole thing with interrupts off */
+	spl = splhigh();
+
+	kprintf("PROCESS MEMORY: DEFAULT LIMIT %u OVER LIMIT %d "
+			"FREE PIDS %u\n",
+			proc_rsslimit, overrsscount, pidfree_count);
+	kprintf("|  pid | ppid |   rss | swapped | limit |\n");
+
+	for (i=0; i<PROC_HASHSIZE; i++)
+	for (ln = list_first(&proctable[i]); ln != NULL;
+	     ln = list_next(&proctable[i], ln))
+	{
+		proc = ln->ln_self;
+		if (proc->exited)
+			continue;
+
+		kprintf("| %4d | %4d | %5u | %7u | %5u |\n",
+				proc->pid,
+				proc->parentpid,
+				proc->rss,
+				proc->swapped,
+				proc->rsslimit);
+	}
 
-	lock_acquire(proctable_lock);
-	cv_broadcast(parentproc->childexit, proctable_lock);
+	splx(spl);
 }
@@ -148,7 +148,8 @@ sys_execv(const char *path, char *argv[])
 	kfree(newargv);
 
 	/* change name of current thread */
-	curthread->t_name = kpath;
+	thread_setname(curthread, kpath);
+	kfree(kpath);
 
 	/* debug */
 	/*
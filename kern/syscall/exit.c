@@ -1,20 +1,23 @@
 #include <types.h>
 #include <lib.h>
 #include <thread.h>
+#include <curthread.h>
+#include <addrspace.h>
 #include <proc.h>
 
 int
 sys__exit(int exitcode)
 {
-	struct process *proc;
+	struct addrspace *as;
 
-	proc = getcurprocess();
+	/* give back our frames and swap while our pid still names them,
+	 * once the parent reaps us the pid can be handed out again */
+	as = curthread->t_vmspace;
+	curthread->t_vmspace = NULL;
+	if (as != NULL)
+		as_destroy(as);
 
-	lock_acquire(proctable_lock);
-	proc->exitcode = exitcode;
-	lock_release(proctable_lock);
-
-	ringparent();
+	proc_exit(exitcode);
 
 	thread_exit();
 }
@@ -6,6 +6,20 @@
 #include <addrspace.h>
 #include <machine/trapframe.h>
 #include <proc.h>
+#include <file.h>
+
+/* undoes a fork whose child never ran. Its filetable goes with it */
+static
+void
+forkfail(pid_t childpid, struct trapframe *childtf, unsigned long *args)
+{
+	kfree(childtf);
+	kfree(args);
+
+	lock_acquire(procexit_lock);
+	freeprocess(getprocess(childpid));
+	lock_release(procexit_lock);
+}
 
 int
 sys_fork(struct trapframe *tf)
@@ -13,7 +27,7 @@ sys_fork(struct trapframe *tf)
 	struct thread *retthread;
 	struct addrspace *retaddrspace;
 	struct trapframe *childtrapframe;
-	struct array *newft;
+	struct fdtable *newft;
 	unsigned long *entryargs;	
 	pid_t childpid;
 	int result;
@@ -43,17 +57,18 @@ sys_fork(struct trapframe *tf)
 
 	/* copy parent's filetable */
 	newft = copyfiletable(curthread->t_pid);
-	if (setfiletable(childpid, newft)<0)
+	if (newft==NULL)
 	{
-		kfree(childtrapframe);
-		kfree(entryargs);
-		array_destroy(newft);
-		return -1;	
+		forkfail(childpid, childtrapframe, entryargs);
+		return -ENOMEM;	
 	}
+	setfiletable(childpid, newft);
 
+	/* as_copy releases what it charged to childpid if it fails */
 	result = as_copy(curthread->t_vmspace, &retaddrspace, childpid);
 	if (result)
 	{
+		forkfail(childpid, childtrapframe, entryargs);
 		return -result;
 	}
 
@@ -61,6 +76,8 @@ sys_fork(struct trapframe *tf)
 	result = thread_fork(curthread->t_name, entryargs, 0, md_forkentry, &retthread);
 	if (result)
 	{
+		as_discard(retaddrspace, childpid);
+		forkfail(childpid, childtrapframe, entryargs);
 		return -result;
 	}
 
@@ -18,9 +18,7 @@ sys_fstat(int fd, struct stat *statbuf)
 	if (mpg==NULL)
 		return EBADF;
 
-	lock_acquire(filetable_lock);
 	result = VOP_STAT(mpg->vn, statbuf);
-	lock_release(filetable_lock);
 
 	if (result)
 		return result;
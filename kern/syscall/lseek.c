@@ -19,13 +19,13 @@ sys_lseek(int fd, off_t pos, int whence)
 		return -EBADF;
 
 
-	lock_acquire(filetable_lock);
+	filemapping_lockoffset(mpg);
 	switch(whence)
 	{
 		case SEEK_SET:
 			if (pos < 0)
 			{
-				lock_release(filetable_lock);
+				filemapping_unlockoffset(mpg);
 				return -EINVAL;
 			}
 			seekto = pos;
@@ -37,19 +37,19 @@ sys_lseek(int fd, off_t pos, int whence)
 			result = VOP_STAT(mpg->vn, &st);
 			if (result)
 			{
-				lock_release(filetable_lock);
+				filemapping_unlockoffset(mpg);
 				return -result;
 			}
 			eof = st.st_size;
 			if ((eof + pos) < 0)
 			{
-				lock_release(filetable_lock);
+				filemapping_unlockoffset(mpg);
 				return -EINVAL;
 			}
 			seekto = eof + pos;
 			break;
 		default:
-			lock_release(filetable_lock);
+			filemapping_unlockoffset(mpg);
 			return -EINVAL;
 	}
 
@@ -57,12 +57,12 @@ sys_lseek(int fd, off_t pos, int whence)
 	result = VOP_TRYSEEK(mpg->vn, seekto);
 	if (result)
 	{
-		lock_release(filetable_lock);
+		filemapping_unlockoffset(mpg);
 		return -result;
 	}
 
-	mpg->offset = seekto;
-	lock_release(filetable_lock);
+	filemapping_setoffset(mpg, seekto);
+	filemapping_unlockoffset(mpg);
 
 	return seekto;
 }
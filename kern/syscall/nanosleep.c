@@ -0,0 +1,46 @@
+#include <types.h>
+#include <lib.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <clock.h>
+#include <timer.h>
+
+#define NSEC_PER_SEC  1000000000
+#define NSEC_PER_TICK (NSEC_PER_SEC / HZ)
+
+/* longest sleep we can express in ticks without overflowing */
+#define MAXSLEEPSECS  (0x7fffffff / HZ - 1)
+
+int
+sys_nanosleep(const struct timespec *req, struct timespec *rem)
+{
+	struct timespec ts;
+	u_int32_t ticks;
+	int result;
+
+	result = copyin((const_userptr_t) req, &ts, sizeof(ts));
+	if (result)
+		return -result;
+
+	if (ts.tv_sec < 0 || ts.tv_sec > MAXSLEEPSECS || 
+	    ts.tv_nsec >= NSEC_PER_SEC)
+		return -EINVAL;
+
+	/* round up to whole ticks; we never sleep short */
+	ticks = ts.tv_sec * HZ + 
+		(ts.tv_nsec + NSEC_PER_TICK - 1) / NSEC_PER_TICK;
+
+	timer_sleep(ticks);
+
+	/* nothing interrupts a sleep, so there's never time left over */
+	if (rem != NULL)
+	{
+		ts.tv_sec = 0;
+		ts.tv_nsec = 0;
+		result = copyout(&ts, (userptr_t) rem, sizeof(ts));
+		if (result)
+			return -result;
+	}
+
+	return 0;
+}
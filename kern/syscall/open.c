@@ -9,18 +9,20 @@ int
 sys_open(char *path, int flags)
 {
 	struct vnode *v;
-	int fd;
+	struct sys_filemapping *fm;
 	int result;
 
 	result = vfs_open(path, flags, &v);
 	if (result)
 		return -result;
 
-	result = newfilemapping(v, flags);  
+	result = newfilemapping(v, flags, &fm);  
 	if (result < 0)
+	{
+		vfs_close(v);
 		return result;
+	}
 
-	fd = addprocfilemapping(result, curthread->t_pid);
-
-	return fd;
+	/* on failure this drops fm, closing v */
+	return addprocfilemapping(fm);
 }
@@ -0,0 +1,44 @@
+#include <types.h>
+#include <lib.h>
+#include <kern/errno.h>
+#include <kern/unistd.h>
+#include <uio.h>
+#include <proc.h>
+#include <file.h>
+#include <syscall.h>
+
+/*
+ * Like write, but at offset pos, leaving the shared offset alone. So
+ * no lock is needed, and processes sharing the file after fork can
+ * write different parts of it at once.
+ */
+int
+sys_pwrite(int fd, const void *buf, size_t buflen, off_t pos)
+{
+	struct sys_filemapping *mpg;
+	struct uio uu;
+	int result;
+
+	mpg = resolvefd(fd);	
+	if (mpg==NULL)
+		return -EBADF;
+
+	/* check flags */
+	if (!((mpg->flags & O_WRONLY) || (mpg->flags & O_RDWR)))
+		return -EBADF;
+
+	if (pos < 0)
+		return -EINVAL;
+
+	/* the console and other devices have no offset to write at */
+	result = VOP_TRYSEEK(mpg->vn, pos);
+	if (result)
+		return -result;
+
+	mk_uuio(&uu, (userptr_t) buf, buflen, pos, UIO_WRITE);
+	result = VOP_WRITE(mpg->vn, &uu);
+	if (result)
+		return -result;
+
+	return buflen - uu.uio_resid;
+}
@@ -10,8 +10,7 @@ int
 sys_read(int fd, void *buf, size_t buflen)
 {
 	struct sys_filemapping *mpg;
-	struct uio ku;
-	void *kbuf;
+	struct uio uu;
 	int result;
 
 	mpg = resolvefd(fd);	
@@ -20,29 +19,21 @@ sys_read(int fd, void *buf, size_t buflen)
 
 	/* check flags */
 	if (!((mpg->flags==O_RDONLY) || (mpg->flags & O_RDWR)))
-		return -1;
-
-	kbuf = kmalloc(buflen);
-	if (kbuf==NULL)
-		return -ENOMEM;
-
-	mk_kuio(&ku, kbuf, buflen, mpg->offset, UIO_READ);
-	result = VOP_READ(mpg->vn, &ku);
+		return -EBADF;
 
+	/* read straight into the user's buffer */
+	filemapping_lockoffset(mpg);
+	mk_uuio(&uu, (userptr_t) buf, buflen, mpg->offset, UIO_READ);
+	result = VOP_READ(mpg->vn, &uu);
 	if (result)
 	{
-		kfree(kbuf);
+		filemapping_unlockoffset(mpg);
 		return -result;
 	}
 
-	mpg->offset += buflen;
-
-	result = copyout(kbuf, buf, buflen);
-	if (result)
-	{
-		kfree(kbuf);
-		return -result;
-	}
+	/* short at end of file, or on the console */
+	filemapping_setoffset(mpg, uu.uio_offset);
+	filemapping_unlockoffset(mpg);
 
-	return buflen;
+	return buflen - uu.uio_resid;
 }
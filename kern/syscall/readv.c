@@ -0,0 +1,50 @@
+#include <types.h>
+#include <lib.h>
+#include <kern/errno.h>
+#include <kern/unistd.h>
+#include <kern/limits.h>
+#include <uio.h>
+#include <proc.h>
+#include <file.h>
+#include <syscall.h>
+
+int
+sys_readv(int fd, const struct iovec *iov, int iovcnt)
+{
+	struct sys_filemapping *mpg;
+	struct iovec kiov[IOV_MAX];
+	struct uio uu;
+	size_t total;
+	int result;
+
+	mpg = resolvefd(fd);	
+	if (mpg==NULL)
+		return -EBADF;
+
+	/* check flags */
+	if (!((mpg->flags==O_RDONLY) || (mpg->flags & O_RDWR)))
+		return -EBADF;
+
+	filemapping_lockoffset(mpg);
+	result = mk_uuiov(&uu, kiov, (const_userptr_t) iov, iovcnt,
+			mpg->offset, UIO_READ);
+	if (result)
+	{
+		filemapping_unlockoffset(mpg);
+		return -result;
+	}
+	total = uu.uio_resid;
+
+	/* one read fills the user's buffers in order */
+	result = VOP_READ(mpg->vn, &uu);
+	if (result)
+	{
+		filemapping_unlockoffset(mpg);
+		return -result;
+	}
+
+	filemapping_setoffset(mpg, uu.uio_offset);
+	filemapping_unlockoffset(mpg);
+
+	return total - uu.uio_resid;
+}
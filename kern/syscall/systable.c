@@ -0,0 +1,472 @@
+/*
+ * System call table and statistics.
+ * See syscall.h for more information.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/callno.h>
+#include <kern/unistd.h>
+#include <lib.h>
+#include <machine/spl.h>
+#include <clock.h>
+#include <uio.h>
+#include <vfs.h>
+#include <dev.h>
+#include <machine/trapframe.h>
+#include <syscall.h>
+
+/*
+ * One wrapper per call, taking the arguments out of the trapframe's
+ * argument registers and converting them to the types the sys_
+ * function is declared with, so every call is checked against its
+ * prototype.
+ */
+
+static
+int
+sc__exit(struct trapframe *tf)
+{
+	return sys__exit((int) tf->tf_a0);
+}
+
+static
+int
+sc_execv(struct trapframe *tf)
+{
+	return sys_execv((const char *) tf->tf_a0, (char **) tf->tf_a1);
+}
+
+static
+int
+sc_fork(struct trapframe *tf)
+{
+	return sys_fork(tf);
+}
+
+static
+int
+sc_waitpid(struct trapframe *tf)
+{
+	return sys_waitpid((pid_t) tf->tf_a0, (int *) tf->tf_a1,
+			   (int) tf->tf_a2);
+}
+
+static
+int
+sc_open(struct trapframe *tf)
+{
+	return sys_open((char *) tf->tf_a0, (int) tf->tf_a1);
+}
+
+static
+int
+sc_read(struct trapframe *tf)
+{
+	return sys_read((int) tf->tf_a0, (void *) tf->tf_a1,
+			(size_t) tf->tf_a2);
+}
+
+static
+int
+sc_write(struct trapframe *tf)
+{
+	return sys_write((int) tf->tf_a0, (const void *) tf->tf_a1,
+			 (size_t) tf->tf_a2);
+}
+
+static
+int
+sc_close(struct trapframe *tf)
+{
+	return sys_close((int) tf->tf_a0);
+}
+
+static
+int
+sc_reboot(struct trapframe *tf)
+{
+	return sys_reboot((int) tf->tf_a0);
+}
+
+static
+int
+sc_lseek(struct trapframe *tf)
+{
+	return sys_lseek((int) tf->tf_a0, (off_t) tf->tf_a1,
+			 (int) tf->tf_a2);
+}
+
+static
+int
+sc_fstat(struct trapframe *tf)
+{
+	return sys_fstat((int) tf->tf_a0, (struct stat *) tf->tf_a1);
+}
+
+static
+int
+sc_mprotect(struct trapframe *tf)
+{
+	return sys_mprotect((unsigned long) tf->tf_a0, (size_t) tf->tf_a1,
+			    (int) tf->tf_a2);
+}
+
+static
+int
+sc_nanosleep(struct trapframe *tf)
+{
+	return sys_nanosleep((const struct timespec *) tf->tf_a0,
+			     (struct timespec *) tf->tf_a1);
+}
+
+static
+int
+sc_readv(struct trapframe *tf)
+{
+	return sys_readv((int) tf->tf_a0, (const struct iovec *) tf->tf_a1,
+			 (int) tf->tf_a2);
+}
+
+static
+int
+sc_writev(struct trapframe *tf)
+{
+	return sys_writev((int) tf->tf_a0, (const struct iovec *) tf->tf_a1,
+			  (int) tf->tf_a2);
+}
+
+static
+int
+sc_pread(struct trapframe *tf)
+{
+	return sys_pread((int) tf->tf_a0, (void *) tf->tf_a1,
+			 (size_t) tf->tf_a2, (off_t) tf->tf_a3);
+}
+
+static
+int
+sc_pwrite(struct trapframe *tf)
+{
+	return sys_pwrite((int) tf->tf_a0, (const void *) tf->tf_a1,
+			  (size_t) tf->tf_a2, (off_t) tf->tf_a3);
+}
+
+#define SC(name, conv) \
+	{ #name, conv, sc_##name, 0, 0, 0, 0, 0 }
+#define SC_NONE \
+	{ NULL, 0, NULL, 0, 0, 0, 0, 0 }
+
+/* Indexed by call number; see kern/callno.h */
+static struct syscall_desc syscalls[] = {
+	SC(_exit,	SC_ERRNO),		/* 0 */
+	SC(execv,	SC_NEGERR),
+	SC(fork,	SC_NEGERR),
+	SC(waitpid,	SC_NEGERR),
+	SC(open,	SC_NEGERR),
+	SC(read,	SC_NEGERR),		/* 5 */
+	SC(write,	SC_NEGERR),
+	SC(close,	SC_NEGERR),
+	SC(reboot,	SC_ERRNO),
+	SC_NONE,				/* sync */
+	SC_NONE,				/* 10: sbrk */
+	SC_NONE,				/* getpid */
+	SC_NONE,				/* ioctl */
+	SC(lseek,	SC_NEGERR),
+	SC_NONE,				/* fsync */
+	SC_NONE,				/* 15: ftruncate */
+	SC(fstat,	SC_ERRNO),
+	SC_NONE,				/* remove */
+	SC_NONE,				/* rename */
+	SC_NONE,				/* link */
+	SC_NONE,				/* 20: mkdir */
+	SC_NONE,				/* rmdir */
+	SC_NONE,				/* chdir */
+	SC_NONE,				/* getdirentry */
+	SC_NONE,				/* symlink */
+	SC_NONE,				/* 25: readlink */
+	SC_NONE,				/* dup2 */
+	SC_NONE,				/* pipe */
+	SC_NONE,				/* __time */
+	SC_NONE,				/* __getcwd */
+	SC_NONE,				/* 30: stat */
+	SC_NONE,				/* lstat */
+	SC_NONE,				/* mmap */
+	SC(mprotect,	SC_ERRNO),
+	SC(nanosleep,	SC_NEGERR),
+	SC(readv,	SC_NEGERR),		/* 35 */
+	SC(writev,	SC_NEGERR),
+	SC(pread,	SC_NEGERR),
+	SC(pwrite,	SC_NEGERR),
+};
+
+#define NSYSCALLS ((int)(sizeof(syscalls)/sizeof(syscalls[0])))
+
+/* Nonzero once gettime works */
+static int syscall_timing;
+
+/* Size of the text the "syscalls:" device gives */
+#define SYSCALL_STATSIZE 4096
+
+struct syscall_desc *
+syscall_lookup(int callno)
+{
+	if (callno < 0 || callno >= NSYSCALLS) {
+		return NULL;
+	}
+	if (syscalls[callno].sd_func == NULL) {
+		return NULL;
+	}
+	return &syscalls[callno];
+}
+
+void
+syscall_enter(struct syscall_desc *sd, time_t *secs, u_int32_t *nsecs)
+{
+	int spl;
+
+	spl = splhigh();
+	sd->sd_ncalls++;
+	splx(spl);
+
+	if (syscall_timing) {
+		gettime(secs, nsecs);
+	}
+	else {
+		*secs = 0;
+		*nsecs = 0;
+	}
+}
+
+void
+syscall_leave(struct syscall_desc *sd, int err, time_t secs,
+	      u_int32_t nsecs)
+{
+	time_t now, isecs;
+	u_int32_t nownsecs, insecs, usecs;
+	int spl;
+
+	if (syscall_timing) {
+		gettime(&now, &nownsecs);
+		getinterval(secs, nsecs, now, nownsecs, &isecs, &insecs);
+	}
+	else {
+		isecs = 0;
+		insecs = 0;
+	}
+	usecs = (isecs >= 4294) ? 0xffffffff :
+		(u_int32_t) isecs*1000000 + insecs/1000;
+
+	spl = splhigh();
+
+	if (err) {
+		sd->sd_nerrors++;
+	}
+
+	sd->sd_totsecs += isecs;
+	sd->sd_totnsecs += insecs;
+	if (sd->sd_totnsecs >= 1000000000) {
+		sd->sd_totnsecs -= 1000000000;
+		sd->sd_totsecs++;
+	}
+	if (usecs > sd->sd_maxusecs) {
+		sd->sd_maxusecs = usecs;
+	}
+
+	splx(spl);
+}
+
+/*
+ * Format the statistics of SD into BUF, or the column headings if SD
+ * is NULL. Returns the length, like snprintf. Interrupts must be off.
+ */
+static
+int
+syscall_formatstats(char *buf, size_t len, struct syscall_desc *sd)
+{
+	u_int32_t avg;
+
+	if (sd == NULL) {
+		return snprintf(buf, len, "  %-10s %9s %9s %15s %10s %10s\n",
+				"call", "calls", "errors", "total (s)",
+				"avg (us)", "max (us)");
+	}
+
+	/* Average in microseconds, if the total fits */
+	avg = 0;
+	if (sd->sd_ncalls > 0 && sd->sd_totsecs < 4294) {
+		avg = ((u_int32_t) sd->sd_totsecs*1000000 +
+		       sd->sd_totnsecs/1000) / sd->sd_ncalls;
+	}
+
+	return snprintf(buf, len, "  %-10s %9lu %9lu %8lu.%06lu %10lu %10lu\n",
+			sd->sd_name,
+			(unsigned long) sd->sd_ncalls,
+			(unsigned long) sd->sd_nerrors,
+			(unsigned long) sd->sd_totsecs,
+			(unsigned long) sd->sd_totnsecs / 1000,
+			(unsigned long) avg,
+			(unsigned long) sd->sd_maxusecs);
+}
+
+void
+syscall_printstats(void)
+{
+	char line[80];
+	int i;
+
+	/* print the whole thing with interrupts off */
+	int spl = splhigh();
+
+	kprintf("System calls:\n");
+	syscall_formatstats(line, sizeof(line), NULL);
+	kprintf("%s", line);
+
+	for (i=0; i<NSYSCALLS; i++) {
+		if (syscalls[i].sd_func == NULL || syscalls[i].sd_ncalls == 0) {
+			continue;
+		}
+		syscall_formatstats(line, sizeof(line), &syscalls[i]);
+		kprintf("%s", line);
+	}
+
+	splx(spl);
+}
+
+void
+syscall_resetstats(void)
+{
+	int i;
+	int spl = splhigh();
+
+	for (i=0; i<NSYSCALLS; i++) {
+		syscalls[i].sd_ncalls = 0;
+		syscalls[i].sd_nerrors = 0;
+		syscalls[i].sd_totsecs = 0;
+		syscalls[i].sd_totnsecs = 0;
+		syscalls[i].sd_maxusecs = 0;
+	}
+
+	splx(spl);
+}
+
+////////////////////////////////////////////////////////////
+//
+// The "syscalls:" device.
+
+/* For open() */
+static
+int
+scstatsopen(struct device *dev, int openflags)
+{
+	(void)dev;
+
+	if (openflags != O_RDONLY) {
+		return EIO;
+	}
+
+	return 0;
+}
+
+/* For close() */
+static
+int
+scstatsclose(struct device *dev)
+{
+	(void)dev;
+	return 0;
+}
+
+/*
+ * For d_io(). Each read takes a fresh snapshot of the statistics as
+ * text and returns what's past the file offset, so reading to EOF
+ * gives the whole table.
+ */
+static
+int
+scstatsio(struct device *dev, struct uio *uio)
+{
+	char *buf;
+	size_t len;
+	int i, spl, result;
+
+	(void)dev;
+
+	if (uio->uio_rw != UIO_READ) {
+		return EIO;
+	}
+
+	buf = kmalloc(SYSCALL_STATSIZE);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+
+	spl = splhigh();
+	len = syscall_formatstats(buf, SYSCALL_STATSIZE, NULL);
+	for (i=0; i<NSYSCALLS && len < SYSCALL_STATSIZE; i++) {
+		if (syscalls[i].sd_func == NULL) {
+			continue;
+		}
+		len += syscall_formatstats(buf+len, SYSCALL_STATSIZE-len,
+					   &syscalls[i]);
+	}
+	splx(spl);
+
+	/* snprintf stops short of the end, leaving room for the NUL */
+	if (len > SYSCALL_STATSIZE-1) {
+		len = SYSCALL_STATSIZE-1;
+	}
+
+	result = 0;
+	if (uio->uio_offset >= 0 && (size_t)uio->uio_offset < len) {
+		result = uiomove(buf + uio->uio_offset,
+				 len - uio->uio_offset, uio);
+	}
+
+	kfree(buf);
+	return result;
+}
+
+/* For ioctl() */
+static
+int
+scstatsioctl(struct device *dev, int op, userptr_t data)
+{
+	/*
+	 * No ioctls.
+	 */
+
+	(void)dev;
+	(void)op;
+	(void)data;
+
+	return EIOCTL;
+}
+
+void
+syscall_bootstrap(void)
+{
+	struct device *dev;
+	int result;
+
+	syscall_timing = 1;
+
+	dev = kmalloc(sizeof(*dev));
+	if (dev==NULL) {
+		panic("syscall_bootstrap: Out of memory\n");
+	}
+
+	dev->d_open = scstatsopen;
+	dev->d_close = scstatsclose;
+	dev->d_io = scstatsio;
+	dev->d_ioctl = scstatsioctl;
+	dev->d_blocks = 0;
+	dev->d_blocksize = 1;
+	dev->d_data = NULL;
+
+	result = vfs_adddev("syscalls", dev, 0);
+	if (result) {
+		panic("syscall_bootstrap: Could not add syscalls device: %s\n",
+		      strerror(result));
+	}
+}
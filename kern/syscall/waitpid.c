@@ -1,24 +1,52 @@
 #include <types.h>
 #include <lib.h>
 #include <kern/errno.h>
+#include <kern/wait.h>
 #include <thread.h>
 #include <curthread.h>
 #include <machine/vm.h>
 #include <proc.h>
 
 /*
- * TODO add support for the -1 parameter.
- * when this is passed in any of the parent's
- * children are waited on. This will require
- * a moditication to the process struct.
- * The process struct will now have to the contain
- * the pid of the last exitted child 
+ * Looks through curproc's children for one matching pid (any of them
+ * if pid is -1) that has exited. Sets *found if there is any matching
+ * child at all. procexit_lock must be held.
+ */
+static
+struct process *
+findexited(struct process *curproc, pid_t pid, int *found)
+{
+	struct listnode *ln;
+	struct process *child;
+
+	*found = 0;
+	for (ln = list_first(&curproc->children); ln != NULL;
+	     ln = list_next(&curproc->children, ln))
+	{
+		child = ln->ln_self;
+		if (pid != -1 && child->pid != pid)
+			continue;
+
+		*found = 1;
+		if (child->exited)
+			return child;
+	}
+
+	return NULL;
+}
+
+/*
+ * Waits for the child pid, or any child if pid is -1, to exit and
+ * reaps it. With WNOHANG returns 0 at once if no such child has
+ * exited yet. Only the caller sleeps on its childexit cv, so it is
+ * woken just by its own children exiting.
  */
 pid_t
 sys_waitpid(pid_t pid, int *status, int options) 
 {
-	struct process *proc;
 	struct process *curproc;
+	struct process *child;
+	int exitcode, found, result;
 
 	/* error checking */
 
@@ -28,37 +56,58 @@ sys_waitpid(pid_t pid, int *status, int options)
 		return (pid_t) -EFAULT;	
 	}
 
-	/* currently, no options should be selected */
-	if (options!=0)
+	if (options & ~WNOHANG)
 	{
-
 		return (pid_t) -EINVAL;
 	}
 
-	proc = getprocess(pid);
-	if (proc==NULL)
+	if (pid != -1 && (pid < PID_MIN || pid >= PID_MAX))
 	{
 		return (pid_t) -EINVAL;
 	}
 
-	if (proc->exited)
+	curproc = getcurprocess();
+
+	/* checking and sleeping under procexit_lock, so a child exiting
+	 * in between can't be missed */
+	lock_acquire(procexit_lock);
+	for (;;)
 	{
-	 	*status = proc->exitcode;
-		/* TODO clean up child here 
-		 * won't be able to do this 
-		 * until a hashtable is implemented.
-		 */
-		return pid;
+		child = findexited(curproc, pid, &found);
+		if (child != NULL || !found || (options & WNOHANG))
+			break;
+		cv_wait(curproc->childexit, procexit_lock);
 	}
 
-	curproc = getcurprocess();
+	if (!found)
+	{
+		lock_release(procexit_lock);
+		return (pid_t) -ECHILD;
+	}
+
+	if (child==NULL)
+	{
+		lock_release(procexit_lock);
+		return 0;
+	}
+
+	/* hand the status over before reaping, so a bad pointer leaves
+	 * the child to be waited for again. The fault path never takes
+	 * procexit_lock */
+	if (status != NULL)
+	{
+		exitcode = child->exitcode;
+		result = copyout(&exitcode, (userptr_t) status, sizeof(int));
+		if (result)
+		{
+			lock_release(procexit_lock);
+			return (pid_t) -result;
+		}
+	}
 
-	/* do the wait */
-	lock_acquire(proctable_lock);
-	cv_wait(curproc->childexit, proctable_lock);
-	lock_release(proctable_lock);
-	/* TODO clean up child here */
+	pid = child->pid;
+	freeprocess(child);
+	lock_release(procexit_lock);
 
-	*status = proc->exitcode;
 	return pid;
 }
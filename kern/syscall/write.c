@@ -10,8 +10,7 @@ int
 sys_write(int fd, const void *buf, size_t nbytes)
 {
 	struct sys_filemapping *mpg;	
-	struct uio ku;
-	char *kbuf;
+	struct uio uu;
 	int result;
 
 	mpg = resolvefd(fd);
@@ -20,29 +19,20 @@ sys_write(int fd, const void *buf, size_t nbytes)
 
 	/* check flags */
 	if (!((mpg->flags & O_WRONLY) || (mpg->flags & O_RDWR)))
-		return -1;
-
-
-	kbuf = (char *) kmalloc(nbytes);
-	if (kbuf==NULL)
-		return -ENOMEM;
-
+		return -EBADF;
 
-	result = copyin(buf, kbuf, nbytes);
+	/* write straight from the user's buffer */
+	filemapping_lockoffset(mpg);
+	mk_uuio(&uu, (userptr_t) buf, nbytes, mpg->offset, UIO_WRITE);
+	result = VOP_WRITE(mpg->vn, &uu);
 	if (result)
 	{
-		kfree(kbuf);
+		filemapping_unlockoffset(mpg);
 		return -result;
 	}
 
-	mk_kuio(&ku, kbuf, nbytes, mpg->offset, UIO_WRITE);
-	result = VOP_WRITE(mpg->vn, &ku);
-
-	if (result)
-		return -result;
-
-	mpg->offset += nbytes;
+	filemapping_setoffset(mpg, uu.uio_offset);
+	filemapping_unlockoffset(mpg);
 
-	kfree(kbuf);
-	return nbytes;
+	return nbytes - uu.uio_resid;
 }
@@ -0,0 +1,115 @@
+#include <types.h>
+#include <lib.h>
+#include <list.h>
+#include <test.h>
+
+#define NLISTGUYS 27
+
+struct listguy {
+	int num;
+	struct listnode node;
+};
+
+static
+void
+checklist(struct list *l, int *expect, int n)
+{
+	struct listnode *ln;
+	int i;
+
+	assert(list_count(l) == (unsigned) n);
+	assert(list_isempty(l) == (n == 0));
+
+	i = 0;
+	for (ln = list_first(l); ln != NULL; ln = list_next(l, ln)) {
+		struct listguy *g = ln->ln_self;
+		assert(i < n);
+		assert(g->num == expect[i]);
+		i++;
+	}
+	assert(i == n);
+}
+
+int
+listtest(int nargs, char **args)
+{
+	struct listguy *guys, *g;
+	struct list l, l2;
+	int expect[NLISTGUYS];
+	int i, n;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Beginning list test...\n");
+
+	guys = kmalloc(NLISTGUYS * sizeof(struct listguy));
+	assert(guys != NULL);
+	for (i=0; i<NLISTGUYS; i++) {
+		guys[i].num = i;
+		listnode_init(&guys[i].node, &guys[i]);
+	}
+
+	list_init(&l);
+	list_init(&l2);
+	checklist(&l, expect, 0);
+	assert(list_remhead(&l) == NULL);
+	assert(list_head(&l) == NULL);
+
+	/* odd ones at the back, even ones at the front */
+	for (i=0; i<NLISTGUYS; i++) {
+		if (i % 2) {
+			list_addtail(&l, &guys[i].node);
+		}
+		else {
+			list_addhead(&l, &guys[i].node);
+		}
+	}
+	n = 0;
+	for (i=NLISTGUYS-1; i>=0; i--) {
+		if (i % 2 == 0) {
+			expect[n++] = i;
+		}
+	}
+	for (i=0; i<NLISTGUYS; i++) {
+		if (i % 2) {
+			expect[n++] = i;
+		}
+	}
+	checklist(&l, expect, n);
+
+	/* take out every multiple of 3 from the middle */
+	for (i=0; i<NLISTGUYS; i+=3) {
+		list_remove(&l, &guys[i].node);
+	}
+	n = 0;
+	for (i=NLISTGUYS-1; i>=0; i--) {
+		if (i % 2 == 0 && i % 3 != 0) {
+			expect[n++] = i;
+		}
+	}
+	for (i=0; i<NLISTGUYS; i++) {
+		if (i % 2 && i % 3 != 0) {
+			expect[n++] = i;
+		}
+	}
+	checklist(&l, expect, n);
+
+	/* move the lot, then drain it in order */
+	list_move(&l2, &l);
+	checklist(&l, expect, 0);
+	checklist(&l2, expect, n);
+
+	for (i=0; i<n; i++) {
+		g = list_head(&l2);
+		assert(g != NULL && g->num == expect[i]);
+		g = list_remhead(&l2);
+		assert(g != NULL && g->num == expect[i]);
+	}
+	checklist(&l2, expect, 0);
+
+	kfree(guys);
+
+	kprintf("List test complete\n");
+	return 0;
+}
@@ -0,0 +1,118 @@
+/*
+ * Stride scheduler share test.
+ *
+ * Runs CPU-bound threads with different ticket counts under the
+ * stride scheduler for a while, then reports how much processor time
+ * each got against the share its tickets entitle it to.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <thread.h>
+#include <curthread.h>
+#include <scheduler.h>
+#include <clock.h>
+#include <test.h>
+
+#define NSTRIDETHREADS 3
+#define STRIDESECS     5
+
+static const int stridetickets[NSTRIDETHREADS] = { 100, 200, 300 };
+
+static volatile int stridestop;
+static volatile unsigned long strideloops[NSTRIDETHREADS];
+static volatile u_int32_t strideticks[NSTRIDETHREADS];
+static struct semaphore *stridedone;
+
+static
+void
+stridethread(void *junk, unsigned long num)
+{
+	unsigned long loops = 0;
+
+	(void)junk;
+
+	scheduler_settickets(curthread, stridetickets[num]);
+
+	while (!stridestop) {
+		loops++;
+	}
+
+	strideloops[num] = loops;
+	strideticks[num] = curthread->t_cputicks;
+	V(stridedone);
+}
+
+int
+stridetest(int nargs, char **args)
+{
+	int i, result, oldmode, secs;
+	u_int32_t totalticks, totaltickets;
+
+	secs = STRIDESECS;
+	if (nargs > 1) {
+		secs = atoi(args[1]);
+		if (secs < 1) {
+			kprintf("Usage: stride [seconds]\n");
+			return EINVAL;
+		}
+	}
+
+	if (stridedone==NULL) {
+		stridedone = sem_create("stridedone", 0);
+		if (stridedone == NULL) {
+			panic("stridetest: sem_create failed\n");
+		}
+	}
+
+	oldmode = scheduler_getmode();
+	scheduler_setmode(SCHED_STRIDE);
+	stridestop = 0;
+
+	kprintf("Starting stride test: %d threads for %d seconds...\n",
+		NSTRIDETHREADS, secs);
+
+	for (i=0; i<NSTRIDETHREADS; i++) {
+		result = thread_fork("stridetest", NULL, i, stridethread,
+				     NULL);
+		if (result) {
+			panic("stridetest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	clocksleep(secs);
+	stridestop = 1;
+
+	for (i=0; i<NSTRIDETHREADS; i++) {
+		P(stridedone);
+	}
+
+	scheduler_setmode(oldmode);
+
+	totalticks = 0;
+	totaltickets = 0;
+	for (i=0; i<NSTRIDETHREADS; i++) {
+		totalticks += strideticks[i];
+		totaltickets += stridetickets[i];
+	}
+	if (totalticks == 0) {
+		totalticks = 1;
+	}
+
+	kprintf("  %-6s %8s %10s %8s %8s\n",
+		"thread", "tickets", "loops", "ticks", "share");
+	for (i=0; i<NSTRIDETHREADS; i++) {
+		kprintf("  %-6d %8d %10lu %8lu %4lu%% (%lu%%)\n", i,
+			stridetickets[i], strideloops[i],
+			(unsigned long) strideticks[i],
+			(unsigned long) (strideticks[i] * 100 / totalticks),
+			(unsigned long) (stridetickets[i] * 100 /
+					 totaltickets));
+	}
+	kprintf("Stride test done.\n");
+
+	return 0;
+}
@@ -8,6 +8,7 @@
 #include <thread.h>
 #include <test.h>
 #include <clock.h>
+#include <machine/spl.h>
 
 #define NSEMLOOPS     63
 #define NLOCKLOOPS    120
@@ -272,3 +273,108 @@ cvtest(int nargs, char **args)
 
 	return 0;
 }
+
+static struct rwlock *testrwlock;
+static volatile int rwreaders, rwmaxreaders;
+
+static
+void
+rwfail(unsigned long num, const char *msg, int writer)
+{
+	kprintf("thread %lu: Mismatch on %s\n", num, msg);
+	kprintf("Test failed\n");
+
+	if (writer) {
+		rwlock_release_write(testrwlock);
+	}
+	else {
+		rwlock_release_read(testrwlock);
+	}
+
+	V(donesem);
+	thread_exit();
+}
+
+/*
+ * Every fourth thread writes: it updates the test values with a yield
+ * in the middle, which readers must never see. Readers check that
+ * they agree, yielding while they hold the lock so that several of
+ * them get to hold it at once.
+ */
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	unsigned long v1;
+	int i, spl;
+	(void)junk;
+
+	for (i=0; i<NLOCKLOOPS; i++) {
+		if (num%4 == 0) {
+			rwlock_acquire_write(testrwlock);
+			if (rwreaders != 0) {
+				rwfail(num, "readers during write", 1);
+			}
+			testval1 = num;
+			thread_yield();
+			testval2 = num*num;
+			rwlock_release_write(testrwlock);
+		}
+		else {
+			rwlock_acquire_read(testrwlock);
+			spl = splhigh();
+			rwreaders++;
+			if (rwreaders > rwmaxreaders) {
+				rwmaxreaders = rwreaders;
+			}
+			splx(spl);
+			v1 = testval1;
+			thread_yield();
+			if (testval1 != v1 || testval2 != v1*v1) {
+				rwfail(num, "testval2/testval1", 0);
+			}
+			spl = splhigh();
+			rwreaders--;
+			splx(spl);
+			rwlock_release_read(testrwlock);
+		}
+	}
+	V(donesem);
+}
+
+int
+rwlocktest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	if (testrwlock==NULL) {
+		testrwlock = rwlock_create("testrwlock");
+		if (testrwlock == NULL) {
+			panic("rwlocktest: rwlock_create failed\n");
+		}
+	}
+	kprintf("Starting rwlock test...\n");
+
+	testval1 = testval2 = 0;
+	rwmaxreaders = 0;
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("synchtest", NULL, i, rwtestthread,
+				     NULL);
+		if (result) {
+			panic("rwlocktest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	kprintf("Up to %d readers at once\n", rwmaxreaders);
+	kprintf("Rwlock test done.\n");
+
+	return 0;
+}
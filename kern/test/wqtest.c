@@ -0,0 +1,134 @@
+/*
+ * Workqueue test.
+ *
+ * Runs a batch of work items on a private queue and checks they all
+ * ran, then checks delayed submission, resubmission of pending work,
+ * and cancellation.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <machine/spl.h>
+#include <synch.h>
+#include <clock.h>
+#include <timer.h>
+#include <workqueue.h>
+#include <test.h>
+
+#define NWQITEMS   32
+#define NWQTHREADS 3
+#define WQDELAY    (HZ/2)
+
+static struct work wqitems[NWQITEMS];
+static volatile int wqcount;
+static struct semaphore *wqdone;
+static u_int32_t wqranat;
+
+static
+void
+wqcountfunc(void *data)
+{
+	int spl;
+
+	(void)data;
+
+	spl = splhigh();
+	wqcount++;
+	splx(spl);
+}
+
+static
+void
+wqdelayfunc(void *data)
+{
+	(void)data;
+
+	wqranat = timer_now();
+	V(wqdone);
+}
+
+static
+void
+wqneverfunc(void *data)
+{
+	(void)data;
+
+	panic("wqtest: cancelled work ran\n");
+}
+
+int
+wqtest(int nargs, char **args)
+{
+	struct workqueue *wq;
+	struct work delayed, never;
+	u_int32_t start;
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	if (wqdone == NULL) {
+		wqdone = sem_create("wqdone", 0);
+		if (wqdone == NULL) {
+			panic("wqtest: sem_create failed\n");
+		}
+	}
+
+	kprintf("Starting workqueue test...\n");
+
+	wq = workqueue_create("wqtest", NWQTHREADS);
+	if (wq == NULL) {
+		kprintf("wqtest: workqueue_create failed\n");
+		return ENOMEM;
+	}
+
+	/* A batch of work, flushed */
+	wqcount = 0;
+	for (i=0; i<NWQITEMS; i++) {
+		work_init(&wqitems[i], wqcountfunc, NULL);
+		result = workqueue_submit(wq, &wqitems[i]);
+		assert(result == 0);
+	}
+	workqueue_flush(wq);
+	if (wqcount != NWQITEMS) {
+		panic("wqtest: %d of %d items ran\n", wqcount, NWQITEMS);
+	}
+	kprintf("  %d items ran\n", wqcount);
+
+	/* Delayed work, which can't be submitted twice */
+	work_init(&delayed, wqdelayfunc, NULL);
+	start = timer_now();
+	result = workqueue_submit_delayed(wq, &delayed, WQDELAY);
+	assert(result == 0);
+	result = workqueue_submit(wq, &delayed);
+	if (result != EBUSY) {
+		panic("wqtest: pending work submitted twice\n");
+	}
+	P(wqdone);
+	if (wqranat - start < WQDELAY) {
+		panic("wqtest: delayed work ran after %lu ticks, not %d\n",
+		      (unsigned long)(wqranat - start), WQDELAY);
+	}
+	kprintf("  delayed work ran after %lu ticks\n",
+		(unsigned long)(wqranat - start));
+
+	/* Cancelled work */
+	work_init(&never, wqneverfunc, NULL);
+	result = workqueue_submit_delayed(wq, &never, WQDELAY);
+	assert(result == 0);
+	if (!workqueue_cancel(&never)) {
+		panic("wqtest: could not cancel pending work\n");
+	}
+	if (workqueue_cancel(&never)) {
+		panic("wqtest: cancelled work cancelled twice\n");
+	}
+	timer_sleep(WQDELAY*2);
+	kprintf("  cancelled work did not run\n");
+
+	workqueue_printstats();
+	workqueue_destroy(wq);
+
+	kprintf("Workqueue test done.\n");
+	return 0;
+}
@@ -2,6 +2,8 @@
 #include <lib.h>
 #include <machine/spl.h>
 #include <thread.h>
+#include <scheduler.h>
+#include <timer.h>
 #include <clock.h>
 
 /* 
@@ -29,7 +31,11 @@ hardclock(void)
 		thread_wakeup(&lbolt);
 	}
 
-	thread_yield();
+	timer_tick();
+
+	if (scheduler_tick()) {
+		thread_yield();
+	}
 }
 
 /*
@@ -38,12 +44,7 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-	int s;
-
-	s = splhigh();
-	while (num_secs > 0) {
-		thread_sleep(&lbolt);
-		num_secs--;
+	if (num_secs > 0) {
+		timer_sleep(num_secs * HZ);
 	}
-	splx(s);
 }
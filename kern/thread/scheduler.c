@@ -1,23 +1,118 @@
 /*
  * Scheduler.
  *
- * The default scheduler is very simple, just a round-robin run queue.
- * You'll want to improve it.
+ * Multi-level feedback queue. There are NLEVELS run queues, level 0
+ * being the most favoured. A thread runs for its level's quantum
+ * before it is preempted; using up the quantum moves it down a level,
+ * and each level's quantum is twice the one above (level 0's is
+ * sched_quantum ticks, settable from the menu), so CPU-bound
+ * threads sink and run less often but for longer. Sleeping moves a
+ * thread back up a level, so threads that mostly wait for I/O or
+ * input stay near the top. Every BOOST_TICKS everything is moved
+ * back to level 0 so that nothing starves.
+ *
+ * If a thread's quantum runs out and nothing else is waiting to run,
+ * it just carries on with a new quantum rather than switching to
+ * itself.
+ *
+ * Above the levels sit priorities. Each priority has its own set of
+ * levels, and a thread at a higher (effective) priority always runs
+ * before any thread at a lower one; the levels only order threads of
+ * equal priority. A thread's effective priority can be raised above
+ * its own by priority inheritance (see synch.c), which moves it to
+ * the other set of queues with scheduler_reprioritize.
+ *
+ * There is also a stride (proportional-share) mode, chosen with the
+ * "stride" kernel option or scheduler_setmode. Each thread holds
+ * tickets (its process's, if it has a process with tickets set) and
+ * gets processor time in proportion to them: every tick it runs
+ * advances its pass by STRIDE1/tickets, and the runnable thread with
+ * the lowest pass runs next. Runnable threads are kept in a skew heap
+ * on pass, linked through the threads themselves, and also on a list
+ * so they can be walked. Priorities and levels are ignored in this
+ * mode.
+ *
+ * All of the queues are intrusive lists (see list.h), so making a
+ * thread runnable never allocates memory and cannot fail.
+ *
+ * For diagnosis, every clock tick is counted as idle or busy along
+ * with how many threads were waiting to run, and context switches are
+ * counted as voluntary or preempted. Optionally (scheduler_setlatency)
+ * each thread is timestamped when it's made runnable and again when
+ * it's dispatched, giving histograms of run queue wait. Lots of idle
+ * time means threads are blocked, typically on I/O; little idle time
+ * with long waits means the CPU is saturated.
  */
 
 #include <types.h>
 #include <lib.h>
 #include <scheduler.h>
 #include <thread.h>
+#include <curthread.h>
+#include <clock.h>
+#include <proc.h>
+#include <kern/errno.h>
 #include <machine/spl.h>
-#include <queue.h>
+#include <list.h>
+#include "opt-stride.h"
 
 /*
  *  Scheduler data
  */
 
-// Queue of runnable threads
-static struct queue *runqueue;
+#define NLEVELS     4
+#define BOOST_TICKS HZ
+
+// Queues of runnable threads, one per priority and level, most
+// favoured first
+#define NRUNQS (NPRIO*NLEVELS)
+#define RUNQ(pri, level) (((PRI_MAX)-(pri))*NLEVELS + (level))
+static struct list runqueues[NRUNQS];
+
+// Ticks in level 0's quantum; each level down doubles it
+static int sched_quantum = 1;
+#define QUANTUM(level) (sched_quantum << (level))
+
+// Statistics
+static u_int32_t sched_preempts;	/* forced switches */
+static u_int32_t sched_extends;		/* expiries with nobody waiting */
+static u_int32_t sched_nvcsw;		/* voluntary context switches */
+static u_int32_t sched_nivcsw;		/* involuntary ones */
+static u_int32_t sched_idleticks;	/* ticks with nothing to run */
+static u_int32_t sched_busyticks;	/* ticks charged to a thread */
+static u_int32_t sched_readysum;	/* sum over ticks of threads waiting */
+
+// Run queue wait statistics, kept while sched_latency is set
+static int sched_latency;
+static u_int32_t sched_latcount;
+static u_int32_t sched_lattotal;	/* microseconds */
+static u_int32_t sched_latmax;
+static u_int32_t sched_lathist[LAT_NBUCKETS];
+
+// Ticks since the last priority boost
+static int boost_counter;
+
+// Bumped at every boost; threads not seen since go back to level 0
+static unsigned boostgen;
+
+// Which scheduler is in use
+#if OPT_STRIDE
+static int sched_mode = SCHED_STRIDE;
+#else
+static int sched_mode = SCHED_MLFQ;
+#endif
+
+// Stride mode: heap of runnable threads, lowest pass first, and a
+// list of the same threads
+#define STRIDE1 (1<<20)
+static struct thread *heaproot;
+static struct list stridelist;
+
+// Stride mode: pass of the thread most recently picked to run
+static u_int32_t global_pass;
+
+// Pass values wrap; compare them by difference
+#define PASS_LT(a, b) ((int)((a) - (b)) < 0)
 
 /*
  * Setup function
@@ -25,24 +120,172 @@ static struct queue *runqueue;
 void
 scheduler_bootstrap(void)
 {
-	runqueue = q_create(32);
-	if (runqueue == NULL) {
-		panic("scheduler: Could not create run queue\n");
+	int i;
+
+	for (i=0; i<NRUNQS; i++) {
+		list_init(&runqueues[i]);
+	}
+	list_init(&stridelist);
+}
+
+/*
+ * Stride mode heap.
+ *
+ * A skew heap: merging two heaps walks down the right spine of each,
+ * taking the lower pass at every step and swapping the children of
+ * each node passed, which keeps the heap balanced enough for
+ * amortized O(log n) insertion and removal with no space outside the
+ * threads.
+ */
+
+static
+struct thread *
+heap_merge(struct thread *a, struct thread *b)
+{
+	struct thread *root, *tmp, **link;
+
+	link = &root;
+	while (a != NULL && b != NULL) {
+		if (PASS_LT(b->t_pass, a->t_pass)) {
+			tmp = a;
+			a = b;
+			b = tmp;
+		}
+		*link = a;
+		tmp = a->t_hleft;
+		a->t_hleft = a->t_hright;
+		a->t_hright = tmp;
+		link = &a->t_hleft;
+		a = a->t_hleft;
+	}
+	*link = (a != NULL) ? a : b;
+	return root;
+}
+
+static
+void
+heap_insert(struct thread *t)
+{
+	t->t_hleft = t->t_hright = NULL;
+	heaproot = heap_merge(heaproot, t);
+	list_addtail(&stridelist, &t->t_listnode);
+}
+
+static
+struct thread *
+heap_popmin(void)
+{
+	struct thread *t;
+
+	t = heaproot;
+	assert(t != NULL);
+	heaproot = heap_merge(t->t_hleft, t->t_hright);
+	t->t_hleft = t->t_hright = NULL;
+	list_remove(&stridelist, &t->t_listnode);
+	return t;
+}
+
+/*
+ * Number of threads waiting to run.
+ */
+static
+unsigned
+nready(void)
+{
+	unsigned n;
+	int i;
+
+	n = list_count(&stridelist);
+	for (i=0; i<NRUNQS; i++) {
+		n += list_count(&runqueues[i]);
 	}
+	return n;
 }
 
 /*
- * Ensure space for handling at least NTHREADS threads.
- * This is done only to ensure that make_runnable() does not fail -
- * if you change the scheduler to not require space outside the 
- * thread structure, for instance, this function can reasonably
- * do nothing.
+ * Run queue wait statistics.
  */
+
+static
 int
-scheduler_preallocate(int nthreads)
+latbucket(u_int32_t usecs)
 {
-	assert(curspl>0);
-	return q_preallocate(runqueue, nthreads);
+	int b = 0;
+
+	usecs >>= 4;
+	while (usecs != 0 && b < LAT_NBUCKETS-1) {
+		usecs >>= 1;
+		b++;
+	}
+	return b;
+}
+
+/* Add USECS to *TOTAL without wrapping */
+static
+void
+lat_add(u_int32_t *total, u_int32_t usecs)
+{
+	if (*total + usecs < *total) {
+		*total = 0xffffffff;
+	}
+	else {
+		*total += usecs;
+	}
+}
+
+/*
+ * T is being made runnable; note when, unless it already has a time
+ * (it's only being moved between queues).
+ */
+static
+void
+lat_ready(struct thread *t)
+{
+	if (sched_latency && t->t_readysecs == 0) {
+		gettime(&t->t_readysecs, &t->t_readynsecs);
+	}
+}
+
+/*
+ * T has been picked to run; record how long it waited.
+ */
+static
+void
+lat_dispatch(struct thread *t)
+{
+	time_t secs, isecs;
+	u_int32_t nsecs, insecs, usecs;
+	int b;
+
+	if (t->t_readysecs == 0) {
+		return;
+	}
+	if (!sched_latency) {
+		t->t_readysecs = 0;
+		return;
+	}
+
+	gettime(&secs, &nsecs);
+	getinterval(t->t_readysecs, t->t_readynsecs, secs, nsecs,
+		    &isecs, &insecs);
+	t->t_readysecs = 0;
+
+	usecs = (isecs >= 4294) ? 0xffffffff : isecs*1000000 + insecs/1000;
+	b = latbucket(usecs);
+
+	t->t_latcount++;
+	lat_add(&t->t_lattotal, usecs);
+	if (usecs > t->t_latmax) {
+		t->t_latmax = usecs;
+	}
+	t->t_lathist[b]++;
+
+	sched_latcount++;
+	lat_add(&sched_lattotal, usecs);
+	if (usecs > sched_latmax) {
+		sched_latmax = usecs;
+	}
+	sched_lathist[b]++;
 }
 
 /*
@@ -54,9 +297,18 @@ scheduler_preallocate(int nthreads)
 void
 scheduler_killall(void)
 {
+	int i;
+
 	assert(curspl>0);
-	while (!q_empty(runqueue)) {
-		struct thread *t = q_remhead(runqueue);
+	for (i=0; i<NRUNQS; i++) {
+		while (!list_isempty(&runqueues[i])) {
+			struct thread *t = list_remhead(&runqueues[i]);
+			t->t_runq = NULL;
+			kprintf("scheduler: Dropping thread %s.\n", t->t_name);
+		}
+	}
+	while (heaproot != NULL) {
+		struct thread *t = heap_popmin();
 		kprintf("scheduler: Dropping thread %s.\n", t->t_name);
 	}
 }
@@ -64,18 +316,32 @@ scheduler_killall(void)
 /*
  * Cleanup function.
  *
- * The queue objects to being destroyed if it's got stuff in it.
- * Use scheduler_killall to make sure this is the case. During
- * ordinary shutdown, normally it should be.
+ * There's nothing to free, but anything still on the queues is
+ * dropped with scheduler_killall. During ordinary shutdown, normally
+ * nothing should be.
  */
 void
 scheduler_shutdown(void)
 {
 	scheduler_killall();
+}
 
-	assert(curspl>0);
-	q_destroy(runqueue);
-	runqueue = NULL;
+/*
+ * Return the most favoured run queue with something on it, or NRUNQS
+ * if nothing is runnable.
+ */
+static
+int
+toplevel(void)
+{
+	int i;
+
+	for (i=0; i<NRUNQS; i++) {
+		if (!list_isempty(&runqueues[i])) {
+			break;
+		}
+	}
+	return i;
 }
 
 /*
@@ -87,10 +353,23 @@ scheduler_shutdown(void)
 struct thread *
 scheduler(void)
 {
+	struct thread *t;
+	int rq;
+
 	// meant to be called with interrupts off
 	assert(curspl>0);
 	
-	while (q_empty(runqueue)) {
+	if (sched_mode == SCHED_STRIDE) {
+		while (heaproot == NULL) {
+			cpu_idle();
+		}
+		t = heap_popmin();
+		global_pass = t->t_pass;
+		lat_dispatch(t);
+		return t;
+	}
+
+	while ((rq = toplevel()) == NRUNQS) {
 		cpu_idle();
 	}
 
@@ -101,12 +380,49 @@ scheduler(void)
 	// 
 	//print_run_queue();
 	
-	return q_remhead(runqueue);
+	t = list_remhead(&runqueues[rq]);
+	t->t_runq = NULL;
+	lat_dispatch(t);
+	return t;
+}
+
+/*
+ * Stride mode make_runnable. Picks up any change in the tickets of
+ * the thread's process. A thread can't bank credit by sleeping: it
+ * rejoins no further behind than the thread that last ran.
+ */
+static
+void
+stride_runnable(struct thread *t)
+{
+	u_int32_t tickets;
+
+	tickets = proc_gettickets(t->t_pid);
+	if (tickets == 0) {
+		tickets = t->t_tickets;
+	}
+	t->t_stride = STRIDE1 / tickets;
+
+	if (PASS_LT(t->t_pass, global_pass)) {
+		t->t_pass = global_pass;
+	}
+
+	if (t->t_ticksleft == 0) {
+		t->t_ticksleft = QUANTUM(0);
+	}
+
+	heap_insert(t);
 }
 
 /* 
  * Make a thread runnable.
- * With the base scheduler, just add it to the end of the run queue.
+ *
+ * A thread that was asleep (it still has its sleep address while it's
+ * being woken) moves up a level. A thread whose quantum ran out has
+ * already been moved down by scheduler_tick. Either way it starts a
+ * fresh quantum; a thread that yielded early keeps what it had left.
+ *
+ * Nothing is allocated, so this always succeeds.
  */
 int
 make_runnable(struct thread *t)
@@ -114,7 +430,444 @@ make_runnable(struct thread *t)
 	// meant to be called with interrupts off
 	assert(curspl>0);
 
-	return q_addtail(runqueue, t);
+	lat_ready(t);
+
+	if (sched_mode == SCHED_STRIDE) {
+		stride_runnable(t);
+		return 0;
+	}
+
+	if (t->t_boostgen != boostgen) {
+		t->t_boostgen = boostgen;
+		t->t_level = 0;
+		t->t_ticksleft = 0;
+	}
+	else if (t->t_sleepaddr != NULL && t->t_level > 0) {
+		t->t_level--;
+		t->t_ticksleft = 0;
+	}
+
+	if (t->t_ticksleft == 0) {
+		t->t_ticksleft = QUANTUM(t->t_level);
+	}
+
+	t->t_runq = &runqueues[RUNQ(t->t_epriority, t->t_level)];
+	list_addtail(t->t_runq, &t->t_listnode);
+	return 0;
+}
+
+/*
+ * Change T's effective priority. If T is waiting to run, it moves to
+ * the queue for its new priority, keeping its level and quantum.
+ */
+void
+scheduler_reprioritize(struct thread *t, int epri)
+{
+	assert(curspl>0);
+	assert(epri >= PRI_MIN && epri <= PRI_MAX);
+
+	if (t->t_epriority == epri) {
+		return;
+	}
+
+	t->t_epriority = epri;
+	if (t->t_runq != NULL) {
+		list_remove(t->t_runq, &t->t_listnode);
+		t->t_runq = &runqueues[RUNQ(epri, t->t_level)];
+		list_addtail(t->t_runq, &t->t_listnode);
+	}
+}
+
+/*
+ * Move everything back to level 0.
+ */
+static
+void
+boost(void)
+{
+	struct thread *t;
+	int pri, i;
+
+	boostgen++;
+
+	for (pri=PRI_MIN; pri<=PRI_MAX; pri++) {
+		for (i=1; i<NLEVELS; i++) {
+			while (!list_isempty(&runqueues[RUNQ(pri, i)])) {
+				t = list_remhead(&runqueues[RUNQ(pri, i)]);
+				t->t_boostgen = boostgen;
+				t->t_level = 0;
+				t->t_ticksleft = QUANTUM(0);
+				t->t_runq = &runqueues[RUNQ(pri, 0)];
+				list_addtail(t->t_runq, &t->t_listnode);
+			}
+		}
+	}
+}
+
+/*
+ * Called from hardclock on every tick. Charges the tick to the current
+ * thread and returns nonzero if it should be preempted: because its
+ * quantum is used up, or because something more favoured is runnable.
+ */
+int
+scheduler_tick(void)
+{
+	struct thread *t = curthread;
+
+	assert(curspl>0);
+
+	boost_counter++;
+	if (boost_counter >= BOOST_TICKS) {
+		boost_counter = 0;
+		boost();
+	}
+
+	sched_readysum += nready();
+
+	if (t == NULL) {
+		/* idle, in the scheduler */
+		sched_idleticks++;
+		return 0;
+	}
+
+	sched_busyticks++;
+	t->t_cputicks++;
+
+	if (t->t_ticksleft > 0) {
+		t->t_ticksleft--;
+	}
+
+	if (sched_mode == SCHED_STRIDE) {
+		t->t_pass += t->t_stride;
+		if (t->t_ticksleft > 0) {
+			return 0;
+		}
+		if (heaproot == NULL) {
+			t->t_ticksleft = QUANTUM(0);
+			sched_extends++;
+			return 0;
+		}
+		sched_preempts++;
+		return 1;
+	}
+
+	if (t->t_ticksleft == 0) {
+		if (t->t_level < NLEVELS-1) {
+			t->t_level++;
+		}
+		if (toplevel() == NRUNQS) {
+			/* nobody else wants the processor */
+			t->t_ticksleft = QUANTUM(t->t_level);
+			sched_extends++;
+			return 0;
+		}
+	}
+	else if (toplevel() >= RUNQ(t->t_epriority, t->t_level)) {
+		return 0;
+	}
+
+	sched_preempts++;
+	return 1;
+}
+
+/*
+ * Count a context switch away from T.
+ */
+void
+scheduler_countswitch(struct thread *t, int involuntary)
+{
+	if (involuntary) {
+		t->t_nivcsw++;
+		sched_nivcsw++;
+	}
+	else {
+		t->t_nvcsw++;
+		sched_nvcsw++;
+	}
+}
+
+/*
+ * Return nonzero if any thread is waiting to run.
+ */
+int
+scheduler_hasready(void)
+{
+	assert(curspl>0);
+	if (sched_mode == SCHED_STRIDE) {
+		return heaproot != NULL;
+	}
+	return toplevel() < NRUNQS;
+}
+
+/*
+ * Switch between MLFQ and stride scheduling. Everything waiting to
+ * run is moved across.
+ */
+void
+scheduler_setmode(int mode)
+{
+	struct thread *t;
+	int i, spl;
+
+	assert(mode == SCHED_MLFQ || mode == SCHED_STRIDE);
+
+	spl = splhigh();
+
+	if (mode == sched_mode) {
+		splx(spl);
+		return;
+	}
+
+	if (mode == SCHED_STRIDE) {
+		sched_mode = mode;
+		for (i=0; i<NRUNQS; i++) {
+			while (!list_isempty(&runqueues[i])) {
+				t = list_remhead(&runqueues[i]);
+				t->t_runq = NULL;
+				stride_runnable(t);
+			}
+		}
+	}
+	else {
+		sched_mode = mode;
+		while (heaproot != NULL) {
+			t = heap_popmin();
+			make_runnable(t);
+		}
+	}
+
+	splx(spl);
+}
+
+int
+scheduler_getmode(void)
+{
+	return sched_mode;
+}
+
+/*
+ * Set the tickets of a thread for stride mode. Tickets set on the
+ * thread's process take precedence.
+ */
+int
+scheduler_settickets(struct thread *t, int tickets)
+{
+	int spl;
+
+	if (tickets < 1 || tickets > STRIDE_MAXTICKETS) {
+		return EINVAL;
+	}
+
+	spl = splhigh();
+	t->t_tickets = tickets;
+	t->t_stride = STRIDE1 / tickets;
+	splx(spl);
+
+	return 0;
+}
+
+/*
+ * Set the level 0 quantum, in ticks.
+ */
+int
+scheduler_setquantum(int ticks)
+{
+	int spl;
+
+	/* the bottom level's quantum mustn't overflow */
+	if (ticks < 1 || ticks > HZ) {
+		return EINVAL;
+	}
+
+	spl = splhigh();
+	sched_quantum = ticks;
+	splx(spl);
+
+	return 0;
+}
+
+/*
+ * Print scheduler settings and statistics, and the run queue.
+ */
+void
+scheduler_printstats(void)
+{
+	int i;
+
+	kprintf("Mode: %s\n", sched_mode==SCHED_STRIDE ? "stride" : "mlfq");
+	kprintf("Quanta (ticks, %d/sec):", HZ);
+	for (i=0; i<NLEVELS; i++) {
+		kprintf(" %d", QUANTUM(i));
+	}
+	kprintf("\n");
+	kprintf("Preemptions: %lu   Quantum extensions: %lu\n",
+		(unsigned long) sched_preempts,
+		(unsigned long) sched_extends);
+	if (curthread != NULL) {
+		kprintf("Current: %s  pri %d/%d  level %d  cpu %lu ticks  "
+			"%lu switches  %lu preempted\n",
+			curthread->t_name, curthread->t_epriority,
+			curthread->t_priority, curthread->t_level,
+			(unsigned long) curthread->t_cputicks,
+			(unsigned long) curthread->t_nvcsw,
+			(unsigned long) curthread->t_nivcsw);
+	}
+	kprintf("Run queue:\n");
+	print_run_queue();
+}
+
+/*
+ * Turn run queue wait measurement on or off.
+ */
+void
+scheduler_setlatency(int on)
+{
+	int spl;
+
+	spl = splhigh();
+	sched_latency = on;
+	splx(spl);
+}
+
+static
+void
+resetthread(struct thread *t, void *junk)
+{
+	int i;
+
+	(void)junk;
+
+	t->t_latcount = 0;
+	t->t_lattotal = 0;
+	t->t_latmax = 0;
+	for (i=0; i<LAT_NBUCKETS; i++) {
+		t->t_lathist[i] = 0;
+	}
+	t->t_nvcsw = 0;
+	t->t_nivcsw = 0;
+	t->t_cputicks = 0;
+}
+
+/*
+ * Zero the utilisation, switch and wait statistics.
+ */
+void
+scheduler_resetstats(void)
+{
+	int i, spl;
+
+	spl = splhigh();
+
+	sched_nvcsw = sched_nivcsw = 0;
+	sched_idleticks = sched_busyticks = 0;
+	sched_readysum = 0;
+	sched_latcount = sched_lattotal = sched_latmax = 0;
+	for (i=0; i<LAT_NBUCKETS; i++) {
+		sched_lathist[i] = 0;
+	}
+	thread_foreach(resetthread, NULL);
+
+	splx(spl);
+}
+
+static
+void
+printlatthread(struct thread *t, void *junk)
+{
+	int i;
+
+	(void)junk;
+
+	kprintf("  %-16s %6lu %6lu %6lu %8lu %8lu %8lu\n", t->t_name,
+		(unsigned long) t->t_cputicks,
+		(unsigned long) t->t_nvcsw,
+		(unsigned long) t->t_nivcsw,
+		(unsigned long) t->t_latcount,
+		(unsigned long) (t->t_latcount ?
+				 t->t_lattotal / t->t_latcount : 0),
+		(unsigned long) t->t_latmax);
+	if (t->t_latcount > 0) {
+		kprintf("  %16s", "");
+		for (i=0; i<LAT_NBUCKETS; i++) {
+			kprintf(" %lu", (unsigned long) t->t_lathist[i]);
+		}
+		kprintf("\n");
+	}
+}
+
+/*
+ * Print CPU utilisation, context switches and run queue waits, for
+ * the system and for each thread.
+ */
+void
+scheduler_printlatency(void)
+{
+	u_int32_t ticks;
+	int i;
+
+	/* print the whole thing with interrupts off */
+	int spl = splhigh();
+
+	ticks = sched_idleticks + sched_busyticks;
+	if (ticks == 0) {
+		ticks = 1;
+	}
+
+	kprintf("CPU: %lu ticks busy, %lu idle (%lu%% busy)  "
+		"avg %lu.%02lu threads waiting to run\n",
+		(unsigned long) sched_busyticks,
+		(unsigned long) sched_idleticks,
+		(unsigned long) (sched_busyticks * 100 / ticks),
+		(unsigned long) (sched_readysum / ticks),
+		(unsigned long) (sched_readysum % ticks * 100 / ticks));
+	kprintf("Context switches: %lu voluntary, %lu involuntary\n",
+		(unsigned long) sched_nvcsw,
+		(unsigned long) sched_nivcsw);
+
+	kprintf("Run queue wait (%s): %lu waits, avg %lu us, max %lu us\n",
+		sched_latency ? "measuring" : "off",
+		(unsigned long) sched_latcount,
+		(unsigned long) (sched_latcount ?
+				 sched_lattotal / sched_latcount : 0),
+		(unsigned long) sched_latmax);
+	for (i=0; i<LAT_NBUCKETS; i++) {
+		if (i < LAT_NBUCKETS-1) {
+			kprintf("  < %6lu us: %lu\n", 16UL << i,
+				(unsigned long) sched_lathist[i]);
+		}
+		else {
+			kprintf(" >= %6lu us: %lu\n", 16UL << (i-1),
+				(unsigned long) sched_lathist[i]);
+		}
+	}
+
+	kprintf("Threads (wait histogram buckets as above):\n");
+	kprintf("  %-16s %6s %6s %6s %8s %8s %8s\n", "name", "ticks",
+		"vcsw", "ivcsw", "waits", "avg us", "max us");
+	thread_foreach(printlatthread, NULL);
+
+	splx(spl);
+}
+
+/*
+ * Print how long T has been waiting to run so far, if known, and end
+ * the line.
+ */
+static
+void
+print_waiting(struct thread *t)
+{
+	time_t secs, isecs;
+	u_int32_t nsecs, insecs;
+
+	if (sched_latency && t->t_readysecs != 0) {
+		gettime(&secs, &nsecs);
+		getinterval(t->t_readysecs, t->t_readynsecs, secs, nsecs,
+			    &isecs, &insecs);
+		kprintf("  waiting %lu.%06lus", (unsigned long) isecs,
+			(unsigned long) insecs/1000);
+	}
+	kprintf("\n");
 }
 
 /*
@@ -126,13 +879,34 @@ print_run_queue(void)
 	/* Turn interrupts off so the whole list prints atomically. */
 	int spl = splhigh();
 
-	int i,k=0;
-	i = q_getstart(runqueue);
-	
-	while (i!=q_getend(runqueue)) {
-		struct thread *t = q_getguy(runqueue, i);
-		kprintf("  %2d: %s %p\n", k, t->t_name, t->t_sleepaddr);
-		i=(i+1)%q_getsize(runqueue);
+	struct listnode *ln;
+	int k=0,rq;
+
+	for (rq=0; rq<NRUNQS; rq++) {
+		struct list *l = &runqueues[rq];
+
+		for (ln = list_first(l); ln != NULL; ln = list_next(l, ln)) {
+			struct thread *t = ln->ln_self;
+			kprintf("  %2d: [%d/%d] %s  cpu %lu  sw %lu/%lu",
+				k, t->t_epriority, t->t_level, t->t_name,
+				(unsigned long) t->t_cputicks,
+				(unsigned long) t->t_nvcsw,
+				(unsigned long) t->t_nivcsw);
+			print_waiting(t);
+			k++;
+		}
+	}
+
+	for (ln = list_first(&stridelist); ln != NULL;
+	     ln = list_next(&stridelist, ln)) {
+		struct thread *t = ln->ln_self;
+		kprintf("  %2d: [pass %lu stride %lu] %s  cpu %lu  sw %lu/%lu",
+			k, (unsigned long) t->t_pass,
+			(unsigned long) t->t_stride, t->t_name,
+			(unsigned long) t->t_cputicks,
+			(unsigned long) t->t_nvcsw,
+			(unsigned long) t->t_nivcsw);
+		print_waiting(t);
 		k++;
 	}
 	
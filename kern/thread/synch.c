@@ -4,11 +4,57 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <kmem.h>
 #include <synch.h>
 #include <thread.h>
 #include <curthread.h>
+#include <scheduler.h>
+#include <clock.h>
 #include <machine/spl.h>
+#include "opt-lockstat.h"
+
+/*
+ * Semaphores, locks, rwlocks and CVs come from their own object caches. The
+ * caches are made on first use, since locks are needed very early in
+ * boot.
+ */
+static struct kmem_cache *sem_cache;
+static struct kmem_cache *lock_cache;
+static struct kmem_cache *cv_cache;
+static struct kmem_cache *rwlock_cache;
+
+static
+void *
+synch_alloc(struct kmem_cache **kcp, const char *kcname, size_t size,
+	    void (*ctor)(void *))
+{
+	int spl;
+
+	spl = splhigh();
+	if (*kcp == NULL) {
+		*kcp = kmem_cache_create(kcname, size, ctor);
+	}
+	splx(spl);
+
+	if (*kcp == NULL) {
+		return NULL;
+	}
+	return kmem_cache_alloc(*kcp);
+}
+
+static
+void
+synch_setname(char *buf, const char *name)
+{
+	size_t i;
+
+	for (i=0; i<SYNCH_NAMELEN-1 && name[i]!=0; i++) {
+		buf[i] = name[i];
+	}
+	buf[i] = 0;
+}
 
 ////////////////////////////////////////////////////////////
 //
@@ -21,17 +67,13 @@ sem_create(const char *namearg, int initial_count)
 
 	assert(initial_count >= 0);
 
-	sem = kmalloc(sizeof(struct semaphore));
+	sem = synch_alloc(&sem_cache, "semaphore", sizeof(struct semaphore),
+			  NULL);
 	if (sem == NULL) {
 		return NULL;
 	}
 
-	sem->name = kstrdup(namearg);
-	if (sem->name == NULL) {
-		kfree(sem);
-		return NULL;
-	}
-
+	synch_setname(sem->name, namearg);
 	sem->count = initial_count;
 	return sem;
 }
@@ -55,8 +97,7 @@ sem_destroy(struct semaphore *sem)
 	 * including the kfrees in the splhigh block, so we don't.
 	 */
 
-	kfree(sem->name);
-	kfree(sem);
+	kmem_cache_free(sem_cache, sem);
 }
 
 void 
@@ -90,33 +131,268 @@ V(struct semaphore *sem)
 	spl = splhigh();
 	sem->count++;
 	assert(sem->count>0);
-	thread_wakeup(sem);
+	thread_wakeone(sem);
 	splx(spl);
 }
 
+////////////////////////////////////////////////////////////
+//
+// Lock statistics.
+
+#if OPT_LOCKSTAT
+
+/* Every lock, for lockstat_dump. Set up on first use, like the caches. */
+static struct list alllocks;
+static int alllocks_inited;
+
+/* Nonzero once gettime works */
+static int lockstat_timing;
+
+/*
+ * Add the time from S1/NS1 to S2/NS2 onto the total in TSECS/TNSECS,
+ * and return it in microseconds (saturating).
+ */
+static
+u_int32_t
+lockstat_addtime(time_t *tsecs, u_int32_t *tnsecs,
+		 time_t s1, u_int32_t ns1, time_t s2, u_int32_t ns2)
+{
+	time_t secs;
+	u_int32_t nsecs;
+
+	getinterval(s1, ns1, s2, ns2, &secs, &nsecs);
+
+	*tsecs += secs;
+	*tnsecs += nsecs;
+	if (*tnsecs >= 1000000000) {
+		*tnsecs -= 1000000000;
+		(*tsecs)++;
+	}
+
+	if (secs >= 4294) {
+		return 0xffffffff;
+	}
+	return secs*1000000 + nsecs/1000;
+}
+
+static
+void
+lockstat_clear(struct lock *lock)
+{
+	lock->ls_acquires = 0;
+	lock->ls_contended = 0;
+	lock->ls_waitsecs = 0;
+	lock->ls_waitnsecs = 0;
+	lock->ls_maxwait = 0;
+	lock->ls_holdsecs = 0;
+	lock->ls_holdnsecs = 0;
+}
+
+static
+void
+lockstat_register(struct lock *lock)
+{
+	int spl;
+
+	lockstat_clear(lock);
+	lock->ls_heldsecs = 0;
+	lock->ls_heldnsecs = 0;
+
+	spl = splhigh();
+	if (!alllocks_inited) {
+		list_init(&alllocks);
+		alllocks_inited = 1;
+	}
+	list_addtail(&alllocks, &lock->ls_node);
+	splx(spl);
+}
+
+static
+void
+lockstat_unregister(struct lock *lock)
+{
+	int spl;
+
+	spl = splhigh();
+	list_remove(&alllocks, &lock->ls_node);
+	splx(spl);
+}
+
+/*
+ * LOCK has just been given to a thread. Interrupts must be off.
+ */
+static
+void
+lockstat_held(struct lock *lock)
+{
+	lock->ls_acquires++;
+	if (lockstat_timing) {
+		gettime(&lock->ls_heldsecs, &lock->ls_heldnsecs);
+	}
+}
+
+/*
+ * LOCK is being released. Interrupts must be off.
+ */
+static
+void
+lockstat_released(struct lock *lock)
+{
+	time_t secs;
+	u_int32_t nsecs;
+
+	/* Held since before timing started; nothing sensible to add */
+	if (!lockstat_timing || lock->ls_heldsecs == 0) {
+		return;
+	}
+	gettime(&secs, &nsecs);
+	lockstat_addtime(&lock->ls_holdsecs, &lock->ls_holdnsecs,
+			 lock->ls_heldsecs, lock->ls_heldnsecs, secs, nsecs);
+}
+
+void
+lockstat_bootstrap(void)
+{
+	lockstat_timing = 1;
+}
+
+void
+lockstat_reset(void)
+{
+	struct listnode *ln;
+	int spl;
+
+	spl = splhigh();
+	if (alllocks_inited) {
+		for (ln = list_first(&alllocks); ln != NULL;
+		     ln = list_next(&alllocks, ln)) {
+			lockstat_clear(ln->ln_self);
+		}
+	}
+	splx(spl);
+}
+
+/* Copy of one lock's statistics, for printing */
+struct lockstat_snap {
+	char name[SYNCH_NAMELEN];
+	u_int32_t acquires, contended, maxwait;
+	time_t waitsecs, holdsecs;
+	u_int32_t waitnsecs, holdnsecs;
+};
+
+#define SNAP_WAITLT(a, b) ((a)->waitsecs < (b)->waitsecs || \
+	((a)->waitsecs == (b)->waitsecs && (a)->waitnsecs < (b)->waitnsecs))
+
+int
+lockstat_dump(void)
+{
+	struct lockstat_snap *snaps, tmp;
+	struct listnode *ln;
+	struct lock *l;
+	unsigned n, max, i, j;
+	int spl;
+
+	/*
+	 * Copy the statistics out with interrupts off, so the locks can't
+	 * go away under us, then sort and print at leisure. Leave some
+	 * slack for locks created while we allocate.
+	 */
+	spl = splhigh();
+	max = alllocks_inited ? list_count(&alllocks) + 16 : 16;
+	splx(spl);
+
+	snaps = kmalloc(max * sizeof(struct lockstat_snap));
+	if (snaps == NULL) {
+		return ENOMEM;
+	}
+
+	n = 0;
+	spl = splhigh();
+	if (alllocks_inited) {
+		for (ln = list_first(&alllocks); ln != NULL && n < max;
+		     ln = list_next(&alllocks, ln)) {
+			l = ln->ln_self;
+			strcpy(snaps[n].name, l->name);
+			snaps[n].acquires = l->ls_acquires;
+			snaps[n].contended = l->ls_contended;
+			snaps[n].maxwait = l->ls_maxwait;
+			snaps[n].waitsecs = l->ls_waitsecs;
+			snaps[n].waitnsecs = l->ls_waitnsecs;
+			snaps[n].holdsecs = l->ls_holdsecs;
+			snaps[n].holdnsecs = l->ls_holdnsecs;
+			n++;
+		}
+	}
+	splx(spl);
+
+	/* Insertion sort, most total wait first */
+	for (i=1; i<n; i++) {
+		tmp = snaps[i];
+		for (j=i; j>0 && SNAP_WAITLT(&snaps[j-1], &tmp); j--) {
+			snaps[j] = snaps[j-1];
+		}
+		snaps[j] = tmp;
+	}
+
+	kprintf("Locks (%u):\n", n);
+	kprintf("  %-24s %9s %9s %15s %10s %15s\n", "name", "acquires",
+		"contended", "wait (s)", "max (us)", "held (s)");
+	for (i=0; i<n; i++) {
+		kprintf("  %-24s %9lu %9lu %8lu.%06lu %10lu %8lu.%06lu\n",
+			snaps[i].name,
+			(unsigned long) snaps[i].acquires,
+			(unsigned long) snaps[i].contended,
+			(unsigned long) snaps[i].waitsecs,
+			(unsigned long) snaps[i].waitnsecs / 1000,
+			(unsigned long) snaps[i].maxwait,
+			(unsigned long) snaps[i].holdsecs,
+			(unsigned long) snaps[i].holdnsecs / 1000);
+	}
+
+	kfree(snaps);
+	return 0;
+}
+
+#endif /* OPT_LOCKSTAT */
+
 ////////////////////////////////////////////////////////////
 //
 // Lock.
 
+/*
+ * Constructor for the lock cache. A lock is only freed when nobody
+ * holds it, which leaves it in this state.
+ */
+static
+void
+lock_ctor(void *obj)
+{
+	struct lock *lock = obj;
+
+	lock->held = 0;
+	lock->holder = NULL;
+	lock->heldnext = NULL;
+#if OPT_LOCKSTAT
+	listnode_init(&lock->ls_node, lock);
+#endif
+}
+
 struct lock *
 lock_create(const char *name)
 {
 	struct lock *lock;
 
-	lock = kmalloc(sizeof(struct lock));
+	lock = synch_alloc(&lock_cache, "lock", sizeof(struct lock),
+			   lock_ctor);
 	if (lock == NULL) {
 		return NULL;
 	}
 
-	lock->name = kstrdup(name);
-	if (lock->name == NULL) {
-		kfree(lock);
-		return NULL;
-	}
-	
-	// add stuff here as needed
-	lock->held = 0;
-	lock->holder = NULL;
+	synch_setname(lock->name, name);
+
+#if OPT_LOCKSTAT
+	lockstat_register(lock);
+#endif
 	
 	return lock;
 }
@@ -127,25 +403,135 @@ lock_destroy(struct lock *lock)
 	assert(lock != NULL);
 
 	// add stuff here as needed
+	assert(!lock->held);
+
+#if OPT_LOCKSTAT
+	lockstat_unregister(lock);
+#endif
 	
-	kfree(lock->name);
-	kfree(lock);
+	kmem_cache_free(lock_cache, lock);
+}
+
+/*
+ * Longest chain of locks priority is passed along. Deadlocked chains
+ * would otherwise go round forever.
+ */
+#define PI_MAXDEPTH 8
+
+/*
+ * Lend priority PRI to the holder of LOCK, and to the holder of any
+ * lock that holder is waiting for, and so on.
+ */
+static
+void
+lock_donate(struct lock *lock, int pri)
+{
+	struct thread *h;
+	int depth;
+
+	for (depth=0; lock != NULL && depth < PI_MAXDEPTH; depth++) {
+		h = lock->holder;
+		if (h == NULL || h->t_epriority >= pri) {
+			break;
+		}
+		scheduler_reprioritize(h, pri);
+		lock = h->t_waitlock;
+	}
+}
+
+void
+lock_updatepriority(struct thread *t)
+{
+	struct lock *l;
+	int pri, wpri;
+
+	assert(curspl>0);
+
+	pri = t->t_priority;
+	for (l = t->t_heldlocks; l != NULL; l = l->heldnext) {
+		wpri = thread_sleeperpriority(l);
+		if (wpri > pri) {
+			pri = wpri;
+		}
+	}
+	scheduler_reprioritize(t, pri);
+
+	/* A waiter's new priority passes on to what it's waiting for */
+	if (t->t_waitlock != NULL) {
+		lock_donate(t->t_waitlock, pri);
+	}
+}
+
+/*
+ * Record that T now holds LOCK. T picks up the priority of anyone
+ * still waiting for it.
+ */
+static
+void
+lock_sethold(struct lock *lock, struct thread *t)
+{
+	lock->holder = t;
+	lock->heldnext = t->t_heldlocks;
+	t->t_heldlocks = lock;
+	lock_updatepriority(t);
+
+#if OPT_LOCKSTAT
+	lockstat_held(lock);
+#endif
 }
 
 void
 lock_acquire(struct lock *lock)
 {
+#if OPT_LOCKSTAT
+	time_t secs1 = 0, secs2;
+	u_int32_t nsecs1 = 0, nsecs2, waited;
+#endif
 	int spl;
 
 	spl = splhigh();	
 
-	while (lock->held)
+	if (lock->held)
 	{
-		thread_sleep(lock);
+#if OPT_LOCKSTAT
+		lock->ls_contended++;
+		if (lockstat_timing) {
+			gettime(&secs1, &nsecs1);
+		}
+#endif
+		curthread->t_waitlock = lock;
+		lock_donate(lock, curthread->t_epriority);
+
+		/*
+		 * lock_release hands the lock straight to the thread
+		 * that has waited longest, so just wait until it's ours.
+		 */
+		while (lock->holder != curthread)
+		{
+			thread_sleep(lock);
+		}
+		assert(lock->held);
+		curthread->t_waitlock = NULL;
+
+#if OPT_LOCKSTAT
+		/* lockstat_held has already set the time we got it */
+		if (lockstat_timing && secs1 != 0) {
+			secs2 = lock->ls_heldsecs;
+			nsecs2 = lock->ls_heldnsecs;
+			waited = lockstat_addtime(&lock->ls_waitsecs,
+						  &lock->ls_waitnsecs,
+						  secs1, nsecs1, secs2, nsecs2);
+			if (waited > lock->ls_maxwait) {
+				lock->ls_maxwait = waited;
+			}
+		}
+#endif
+	}
+	else
+	{
+		lock->held = 1;
+		lock_sethold(lock, curthread);
 	}
-
-	lock->held = 1;
-	lock->holder = curthread;
 
 	splx(spl);
 }
@@ -153,15 +539,41 @@ lock_acquire(struct lock *lock)
 void
 lock_release(struct lock *lock)
 {
+	struct lock **lp;
+	struct thread *next;
 	int spl;
 
 	spl = splhigh();
 
 	if (lock_do_i_hold(lock))
 	{
-		lock->held = 0;
-		lock->holder = NULL;
-		thread_wakeup(lock);
+		for (lp = &curthread->t_heldlocks; *lp != lock;
+		     lp = &(*lp)->heldnext)
+		{
+			assert(*lp != NULL);
+		}
+		*lp = lock->heldnext;
+		lock->heldnext = NULL;
+
+#if OPT_LOCKSTAT
+		lockstat_released(lock);
+#endif
+
+		/* Pass the lock on to the oldest waiter, if any */
+		next = thread_wakeone(lock);
+		if (next == NULL)
+		{
+			lock->held = 0;
+			lock->holder = NULL;
+		}
+		else
+		{
+			next->t_waitlock = NULL;
+			lock_sethold(lock, next);
+		}
+
+		/* Drop whatever we had inherited through this lock */
+		lock_updatepriority(curthread);
 	}
 
 	splx(spl);
@@ -184,6 +596,183 @@ lock_do_i_hold(struct lock *lock)
 	return 0;
 }
 
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+//
+// Waiting readers sleep on rw_readers and waiting writers on
+// rw_writer. The lock is handed over by whoever releases it: a
+// writer is made the holder before it's woken, and a batch of readers
+// is counted in before they're woken, so nobody has to contend for the
+// lock again after waking up.
+
+/*
+ * Waiting writers sleep on the address of rw_writer and waiting readers
+ * on that of rw_readers. The addresses are only keys, so the casts drop
+ * the fields' volatile.
+ */
+#define RW_WKEY(rw) ((const void *)&(rw)->rw_writer)
+#define RW_RKEY(rw) ((const void *)&(rw)->rw_readers)
+
+/*
+ * Constructor for the rwlock cache. rwlock_destroy checks a lock is
+ * back in this state, apart from rw_rgen, which only ever moves on.
+ */
+static
+void
+rwlock_ctor(void *obj)
+{
+	struct rwlock *rw = obj;
+
+	rw->rw_readers = 0;
+	rw->rw_writer = NULL;
+	rw->rw_rwaiting = 0;
+	rw->rw_wwaiting = 0;
+	rw->rw_rgen = 0;
+}
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = synch_alloc(&rwlock_cache, "rwlock", sizeof(struct rwlock),
+			 rwlock_ctor);
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	synch_setname(rw->name, name);
+
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	assert(rw != NULL);
+	assert(rw->rw_readers == 0 && rw->rw_writer == NULL);
+	assert(rw->rw_rwaiting == 0 && rw->rw_wwaiting == 0);
+
+	kmem_cache_free(rwlock_cache, rw);
+}
+
+/*
+ * Give the lock to the writer that has waited longest, if there is
+ * one. The lock must be free. Interrupts must be off.
+ */
+static
+void
+rwlock_handoff_write(struct rwlock *rw)
+{
+	assert(rw->rw_readers == 0 && rw->rw_writer == NULL);
+
+	if (rw->rw_wwaiting > 0) {
+		rw->rw_writer = thread_wakeone(RW_WKEY(rw));
+		assert(rw->rw_writer != NULL);
+		rw->rw_wwaiting--;
+	}
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	unsigned gen;
+	int spl;
+
+	assert(in_interrupt==0);
+
+	spl = splhigh();
+
+	assert(rw->rw_writer != curthread);
+
+	if (rw->rw_writer == NULL && rw->rw_wwaiting == 0) {
+		rw->rw_readers++;
+	}
+	else {
+		/* rwlock_release_write counts us in before waking us */
+		rw->rw_rwaiting++;
+		gen = rw->rw_rgen;
+		while (rw->rw_rgen == gen) {
+			thread_sleep(RW_RKEY(rw));
+		}
+	}
+	assert(rw->rw_readers > 0 && rw->rw_writer == NULL);
+
+	splx(spl);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	int spl;
+
+	spl = splhigh();
+
+	assert(rw->rw_readers > 0);
+	rw->rw_readers--;
+	if (rw->rw_readers == 0) {
+		rwlock_handoff_write(rw);
+	}
+
+	splx(spl);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	int spl;
+
+	assert(in_interrupt==0);
+
+	spl = splhigh();
+
+	assert(rw->rw_writer != curthread);
+
+	if (rw->rw_writer == NULL && rw->rw_readers == 0) {
+		rw->rw_writer = curthread;
+	}
+	else {
+		rw->rw_wwaiting++;
+		while (rw->rw_writer != curthread) {
+			thread_sleep(RW_WKEY(rw));
+		}
+	}
+	assert(rw->rw_readers == 0);
+
+	splx(spl);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	int spl;
+
+	spl = splhigh();
+
+	assert(rw->rw_writer == curthread);
+	rw->rw_writer = NULL;
+
+	if (rw->rw_rwaiting > 0) {
+		/* Let in everyone who queued up behind us */
+		rw->rw_readers = rw->rw_rwaiting;
+		rw->rw_rwaiting = 0;
+		rw->rw_rgen++;
+		thread_wakeup(RW_RKEY(rw));
+	}
+	else {
+		rwlock_handoff_write(rw);
+	}
+
+	splx(spl);
+}
+
+int
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+	return rw->rw_writer == curthread;
+}
+
 ////////////////////////////////////////////////////////////
 //
 // CV
@@ -194,16 +783,13 @@ cv_create(const char *name)
 {
 	struct cv *cv;
 
-	cv = kmalloc(sizeof(struct cv));
+	/* nothing but the name, so no constructor */
+	cv = synch_alloc(&cv_cache, "cv", sizeof(struct cv), NULL);
 	if (cv == NULL) {
 		return NULL;
 	}
 
-	cv->name = kstrdup(name);
-	if (cv->name==NULL) {
-		kfree(cv);
-		return NULL;
-	}
+	synch_setname(cv->name, name);
 	
 	return cv;
 }
@@ -213,8 +799,7 @@ cv_destroy(struct cv *cv)
 {
 	assert(cv != NULL);
 	
-	kfree(cv->name);
-	kfree(cv);
+	kmem_cache_free(cv_cache, cv);
 }
 
 void
@@ -241,11 +826,31 @@ cv_wait(struct cv *cv, struct lock *lock)
 	splx(spl);
 }
 
+int
+cv_timedwait(struct cv *cv, struct lock *lock, u_int32_t ticks)
+{
+	int spl, result;
+
+	spl = splhigh();
+
+	lock_release(lock);
+	result = thread_sleep_timeout(cv, ticks);
+	lock_acquire(lock);
+
+	splx(spl);
+	return result;
+}
+
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
-	(void)cv;
-	(void)lock;
+	int spl;
+
+	assert(lock_do_i_hold(lock));
+
+	spl = splhigh();
+	thread_wakeone(cv);
+	splx(spl);
 }
 
 void
@@ -253,11 +858,9 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 {
 	int spl;
 
-	spl = splhigh();
-
-	lock_release(lock);
+	assert(lock_do_i_hold(lock));
 
+	spl = splhigh();
 	thread_wakeup(cv);
-
 	splx(spl);
 }
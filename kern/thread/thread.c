@@ -4,12 +4,15 @@
 #include <types.h>
 #include <lib.h>
 #include <kern/errno.h>
-#include <array.h>
+#include <kmem.h>
+#include <list.h>
 #include <machine/spl.h>
 #include <machine/pcb.h>
 #include <thread.h>
 #include <curthread.h>
 #include <scheduler.h>
+#include <synch.h>
+#include <timer.h>
 #include <addrspace.h>
 #include <vnode.h>
 #include "opt-synchprobs.h"
@@ -25,43 +28,216 @@ typedef enum {
 /* Global variable for the thread currently executing at any given time. */
 struct thread *curthread;
 
-/* Table of sleeping threads. */
-static struct array *sleepers;
+/*
+ * Sleeping threads, kept in wait channels: one FIFO queue of threads
+ * per sleep address, with the channels hashed on the address.
+ *
+ * Every thread owns one wait channel while it's awake. The first
+ * thread to sleep on an address lends its channel to the address;
+ * later ones park theirs on the channel's spares list. Each thread
+ * leaving takes a spare back, and the last one out takes the channel
+ * itself. So going to sleep and waking up never allocate anything.
+ */
+struct wchan {
+	const void *wc_addr;
+	struct list wc_threads;		/* sleepers, longest asleep first */
+	struct list wc_spares;		/* channels lent by the sleepers */
+	struct listnode wc_node;	/* on hash chain, or on a spares list */
+};
+
+#define WCHAN_BITS 6
+#define NWCHANS    (1 << WCHAN_BITS)
+#define WCHAN_HASH(addr) \
+	(((u_int32_t)(addr) * 2654435761U) >> (32 - WCHAN_BITS))
+static struct list wchans[NWCHANS];
 
 /* List of dead threads to be disposed of. */
-static struct array *zombies;
+static struct list zombies;
+
+/* Every thread that hasn't exited, for thread_foreach. */
+static struct list allthreads;
 
-/* Total number of outstanding threads. Does not count zombies[]. */
+/* Total number of outstanding threads. Does not count zombies. */
 static int numthreads;
 
+/* Caches the thread structures and wait channels come from. */
+static struct kmem_cache *thread_cache;
+static struct kmem_cache *wchan_cache;
+
+/*
+ * Pool of dead threads that still have their stacks, ready to be
+ * handed straight out again by thread_fork. Bounded, so a burst of
+ * threads doesn't pin its stacks forever.
+ */
+#define THREADPOOL_MAX 16
+static struct list threadpool;
+
+/*
+ * Set the name of a thread. Names are kept in the thread structure;
+ * longer ones are truncated.
+ */
+void
+thread_setname(struct thread *thread, const char *name)
+{
+	size_t i;
+
+	for (i=0; i<THREAD_NAMELEN-1 && name[i]!=0; i++) {
+		thread->t_name[i] = name[i];
+	}
+	thread->t_name[i] = 0;
+}
+
+/*
+ * Reset every field of a thread structure except its stack and its
+ * wait channel.
+ */
+static
+void
+thread_init(struct thread *thread, const char *name)
+{
+	int i;
+
+	thread_setname(thread, name);
+	thread->t_sleepaddr = NULL;
+	thread->t_sleepchan = NULL;
+	thread->t_level = 0;
+	thread->t_ticksleft = 0;
+	thread->t_boostgen = 0;
+	thread->t_tickets = STRIDE_DEFTICKETS;
+	thread->t_stride = 0;
+	thread->t_pass = 0;
+	thread->t_hleft = NULL;
+	thread->t_hright = NULL;
+	thread->t_cputicks = 0;
+	thread->t_nvcsw = 0;
+	thread->t_nivcsw = 0;
+	thread->t_readysecs = 0;
+	thread->t_readynsecs = 0;
+	thread->t_latcount = 0;
+	thread->t_lattotal = 0;
+	thread->t_latmax = 0;
+	for (i=0; i<LAT_NBUCKETS; i++) {
+		thread->t_lathist[i] = 0;
+	}
+	thread->t_runq = NULL;
+	thread->t_priority = PRI_NORMAL;
+	thread->t_epriority = PRI_NORMAL;
+	thread->t_heldlocks = NULL;
+	thread->t_waitlock = NULL;
+	thread->t_timedout = 0;
+	
+	thread->t_pid = 0;
+	thread->t_proc = NULL;
+	thread->t_vmspace = NULL;
+
+	thread->t_cwd = NULL;
+	
+	// If you add things to the thread structure, be sure to initialize
+	// them here.
+}
+
+/*
+ * Constructors for the thread and wait channel caches. A thread's list
+ * nodes are off every list by the time it's freed, and the channel it
+ * owns then is idle, so both go back in the state set up here.
+ */
+static
+void
+thread_ctor(void *obj)
+{
+	struct thread *thread = obj;
+
+	listnode_init(&thread->t_listnode, thread);
+	listnode_init(&thread->t_allnode, thread);
+}
+
+static
+void
+wchan_ctor(void *obj)
+{
+	struct wchan *wc = obj;
+
+	wc->wc_addr = NULL;
+	list_init(&wc->wc_threads);
+	list_init(&wc->wc_spares);
+	listnode_init(&wc->wc_node, wc);
+}
+
 /*
  * Create a thread. This is used both to create the first thread's 
  * thread structure and to create subsequent threads.
  */
-
 static
 struct thread *
 thread_create(const char *name)
 {
-	struct thread *thread = kmalloc(sizeof(struct thread));
+	struct thread *thread = kmem_cache_alloc(thread_cache);
 	if (thread==NULL) {
 		return NULL;
 	}
-	thread->t_name = kstrdup(name);
-	if (thread->t_name==NULL) {
-		kfree(thread);
+
+	thread->t_wchan = kmem_cache_alloc(wchan_cache);
+	if (thread->t_wchan==NULL) {
+		kmem_cache_free(thread_cache, thread);
 		return NULL;
 	}
-	thread->t_sleepaddr = NULL;
+	thread_init(thread, name);
 	thread->t_stack = NULL;
 	
-	thread->t_vmspace = NULL;
+	return thread;
+}
+
+/*
+ * Free a thread structure and its wait channel.
+ */
+static
+void
+thread_free(struct thread *thread)
+{
+	/* back in their constructed state */
+	assert(thread->t_wchan->wc_addr == NULL);
+	assert(list_isempty(&thread->t_wchan->wc_threads));
+	assert(list_isempty(&thread->t_wchan->wc_spares));
+	assert(thread->t_listnode.ln_next == NULL);
+	assert(thread->t_allnode.ln_next == NULL);
+
+	kmem_cache_free(wchan_cache, thread->t_wchan);
+	kmem_cache_free(thread_cache, thread);
+}
+
+/*
+ * Get a thread with a stack for thread_fork: from the pool if there's
+ * one there, otherwise a fresh one.
+ */
+static
+struct thread *
+thread_alloc(const char *name)
+{
+	struct thread *thread;
+	int s;
+
+	s = splhigh();
+	thread = list_remhead(&threadpool);
+	splx(s);
+
+	if (thread != NULL) {
+		char *stack = thread->t_stack;
+		thread_init(thread, name);
+		thread->t_stack = stack;
+		return thread;
+	}
+
+	thread = thread_create(name);
+	if (thread==NULL) {
+		return NULL;
+	}
+
+	thread->t_stack = kmalloc(STACK_SIZE);
+	if (thread->t_stack==NULL) {
+		thread_free(thread);
+		return NULL;
+	}
 
-	thread->t_cwd = NULL;
-	
-	// If you add things to the thread structure, be sure to initialize
-	// them here.
-	
 	return thread;
 }
 
@@ -75,6 +251,8 @@ static
 void
 thread_destroy(struct thread *thread)
 {
+	int s;
+
 	assert(thread != curthread);
 
 	// If you add things to the thread structure, be sure to dispose of
@@ -83,13 +261,22 @@ thread_destroy(struct thread *thread)
 	// These things are cleaned up in thread_exit.
 	assert(thread->t_vmspace==NULL);
 	assert(thread->t_cwd==NULL);
+
+	/* Keep it, stack and all, for the next thread_fork if there's room */
+	s = splhigh();
+	if (thread->t_stack != NULL &&
+	    list_count(&threadpool) < THREADPOOL_MAX) {
+		list_addhead(&threadpool, &thread->t_listnode);
+		splx(s);
+		return;
+	}
+	splx(s);
 	
 	if (thread->t_stack) {
 		kfree(thread->t_stack);
 	}
 
-	kfree(thread->t_name);
-	kfree(thread);
+	thread_free(thread);
 }
 
 
@@ -101,18 +288,93 @@ static
 void
 exorcise(void)
 {
-	int i, result;
+	struct thread *z;
 
 	assert(curspl>0);
 	
-	for (i=0; i<array_getnum(zombies); i++) {
-		struct thread *z = array_getguy(zombies, i);
+	while ((z = list_remhead(&zombies)) != NULL) {
 		assert(z!=curthread);
 		thread_destroy(z);
 	}
-	result = array_setsize(zombies, 0);
-	/* Shrinking the array; not supposed to be able to fail. */
-	assert(result==0);
+}
+
+/*
+ * Find the wait channel for ADDR, or NULL if nobody is sleeping on it.
+ */
+static
+struct wchan *
+wchan_find(const void *addr)
+{
+	struct list *chain = &wchans[WCHAN_HASH(addr)];
+	struct listnode *ln;
+	struct wchan *wc;
+
+	for (ln = list_first(chain); ln != NULL; ln = list_next(chain, ln)) {
+		wc = ln->ln_self;
+		if (wc->wc_addr == addr) {
+			return wc;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Put T at the back of the wait channel for T->t_sleepaddr.
+ */
+static
+void
+wchan_enqueue(struct thread *t)
+{
+	struct wchan *wc;
+
+	assert(curspl>0);
+	assert(t->t_wchan != NULL);
+
+	wc = wchan_find(t->t_sleepaddr);
+	if (wc == NULL) {
+		wc = t->t_wchan;
+		wc->wc_addr = t->t_sleepaddr;
+		list_addtail(&wchans[WCHAN_HASH(wc->wc_addr)], &wc->wc_node);
+	}
+	else {
+		list_addtail(&wc->wc_spares, &t->t_wchan->wc_node);
+	}
+	t->t_wchan = NULL;
+
+	t->t_sleepchan = wc;
+	list_addtail(&wc->wc_threads, &t->t_listnode);
+}
+
+/*
+ * Take T out of the wait channel it's sleeping in. Returns zero if it
+ * wasn't in one (it has already been woken).
+ */
+static
+int
+wchan_remove(struct thread *t)
+{
+	struct wchan *wc = t->t_sleepchan;
+
+	assert(curspl>0);
+
+	if (wc == NULL) {
+		return 0;
+	}
+
+	list_remove(&wc->wc_threads, &t->t_listnode);
+	if (list_isempty(&wc->wc_threads)) {
+		/* Last one out; the channel itself is free again */
+		list_remove(&wchans[WCHAN_HASH(wc->wc_addr)], &wc->wc_node);
+		wc->wc_addr = NULL;
+		t->t_wchan = wc;
+	}
+	else {
+		t->t_wchan = list_remhead(&wc->wc_spares);
+	}
+	assert(t->t_wchan != NULL);
+
+	t->t_sleepchan = NULL;
+	return 1;
 }
 
 /*
@@ -123,7 +385,7 @@ static
 void
 thread_killall(void)
 {
-	int i, result;
+	int i;
 
 	assert(curspl>0);
 
@@ -132,23 +394,30 @@ thread_killall(void)
 	 * wake up while we're shutting down.
 	 */
 
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
-		kprintf("sleep: Dropping thread %s\n", t->t_name);
-
-		/*
-		 * Don't do this: because these threads haven't
-		 * been through thread_exit, thread_destroy will
-		 * get upset. Just drop the threads on the floor,
-		 * which is safer anyway during panic.
-		 *
-		 * array_add(zombies, t);
-		 */
+	for (i=0; i<NWCHANS; i++) {
+		struct listnode *cn, *tn;
+
+		for (cn = list_first(&wchans[i]); cn != NULL;
+		     cn = list_next(&wchans[i], cn)) {
+			struct wchan *wc = cn->ln_self;
+
+			for (tn = list_first(&wc->wc_threads); tn != NULL;
+			     tn = list_next(&wc->wc_threads, tn)) {
+				struct thread *t = tn->ln_self;
+				kprintf("sleep: Dropping thread %s\n", t->t_name);
+
+				/*
+				 * Don't do this: because these threads haven't
+				 * been through thread_exit, thread_destroy will
+				 * get upset. Just drop the threads on the floor,
+				 * which is safer anyway during panic.
+				 *
+				 * list_addtail(&zombies, &t->t_listnode);
+				 */
+			}
+		}
+		list_init(&wchans[i]);
 	}
-
-	result = array_setsize(sleepers, 0);
-	/* shrinking array: not supposed to fail */
-	assert(result==0);
 }
 
 /*
@@ -206,17 +475,27 @@ struct thread *
 thread_bootstrap(void)
 {
 	struct thread *me;
+	int i;
 
 	/* Create the data structures we need. */
-	sleepers = array_create();
-	if (sleepers==NULL) {
-		panic("Cannot create sleepers array\n");
+	thread_cache = kmem_cache_create("thread", sizeof(struct thread),
+					 thread_ctor);
+	if (thread_cache==NULL) {
+		panic("Cannot create thread cache\n");
 	}
 
-	zombies = array_create();
-	if (zombies==NULL) {
-		panic("Cannot create zombies array\n");
+	wchan_cache = kmem_cache_create("wchan", sizeof(struct wchan),
+					wchan_ctor);
+	if (wchan_cache==NULL) {
+		panic("Cannot create wait channel cache\n");
 	}
+
+	for (i=0; i<NWCHANS; i++) {
+		list_init(&wchans[i]);
+	}
+	list_init(&zombies);
+	list_init(&threadpool);
+	list_init(&allthreads);
 	
 	/*
 	 * Create the thread structure for the first thread
@@ -237,6 +516,7 @@ thread_bootstrap(void)
 
 	/* Set curthread */
 	curthread = me;
+	list_addtail(&allthreads, &me->t_allnode);
 
 	/* Number of threads starts at 1 */
 	numthreads = 1;
@@ -251,10 +531,7 @@ thread_bootstrap(void)
 void
 thread_shutdown(void)
 {
-	array_destroy(sleepers);
-	sleepers = NULL;
-	array_destroy(zombies);
-	zombies = NULL;
+	// Nothing to free; the zombies are cleaned up by the next switch.
 	// Don't do this - it frees our stack and we blow up
 	//thread_destroy(curthread);
 }
@@ -273,19 +550,23 @@ thread_fork(const char *name,
 	struct thread *newguy;
 	int s, result;
 
-	/* Allocate a thread */
-	newguy = thread_create(name);
+	/* Allocate a thread, with a stack */
+	newguy = thread_alloc(name);
 	if (newguy==NULL) {
 		return ENOMEM;
 	}
 
-	/* Allocate a stack */
-	newguy->t_stack = kmalloc(STACK_SIZE);
-	if (newguy->t_stack==NULL) {
-		kfree(newguy->t_name);
-		kfree(newguy);
-		return ENOMEM;
-	}
+	/* Run at the creator's own priority, not an inherited one */
+	newguy->t_priority = curthread->t_priority;
+	newguy->t_epriority = curthread->t_priority;
+	newguy->t_tickets = curthread->t_tickets;
+	newguy->t_pass = curthread->t_pass;
+
+	/* Belong to the creator's process until told otherwise (fork
+	 * does). Not whatever process last used this thread structure,
+	 * its pid may well have been handed to someone else by now */
+	newguy->t_pid = curthread->t_pid;
+	newguy->t_proc = curthread->t_proc;
 
 	/* stick a magic number on the bottom end of the stack */
 	newguy->t_stack[0] = 0xae;
@@ -305,25 +586,6 @@ thread_fork(const char *name,
 	/* Interrupts off for atomicity */
 	s = splhigh();
 
-	/*
-	 * Make sure our data structures have enough space, so we won't
-	 * run out later at an inconvenient time.
-	 */
-	result = array_preallocate(sleepers, numthreads+1);
-	if (result) {
-		goto fail;
-	}
-	result = array_preallocate(zombies, numthreads+1);
-	if (result) {
-		goto fail;
-	}
-
-	/* Do the same for the scheduler. */
-	result = scheduler_preallocate(numthreads+1);
-	if (result) {
-		goto fail;
-	}
-
 	/* Make the new thread runnable */
 	result = make_runnable(newguy);
 	if (result != 0) {
@@ -332,11 +594,11 @@ thread_fork(const char *name,
 
 	/*
 	 * Increment the thread counter. This must be done atomically
-	 * with the preallocate calls; otherwise the count can be
-	 * temporarily too low, which would obviate its reason for
-	 * existence.
+	 * with make_runnable; otherwise the count can be temporarily
+	 * too low, which would obviate its reason for existence.
 	 */
 	numthreads++;
+	list_addtail(&allthreads, &newguy->t_allnode);
 
 	/* Done with stuff that needs to be atomic */
 	splx(s);
@@ -357,10 +619,9 @@ thread_fork(const char *name,
 	splx(s);
 	if (newguy->t_cwd != NULL) {
 		VOP_DECREF(newguy->t_cwd);
+		newguy->t_cwd = NULL;
 	}
-	kfree(newguy->t_stack);
-	kfree(newguy->t_name);
-	kfree(newguy);
+	thread_destroy(newguy);
 
 	return result;
 }
@@ -405,33 +666,34 @@ mi_switch(threadstate_t nextstate)
 
 	/*
 	 * Stash the current thread on whatever list it's supposed to go on.
-	 * Because we preallocate during thread_fork, this should not fail.
+	 * The lists are all intrusive, so this can't fail.
 	 */
 
 	if (nextstate==S_READY) {
 		result = make_runnable(cur);
+		assert(result==0);
 	}
 	else if (nextstate==S_SLEEP) {
-		/*
-		 * Because we preallocate sleepers[] during thread_fork,
-		 * this should never fail.
-		 */
-		result = array_add(sleepers, cur);
+		wchan_enqueue(cur);
 	}
 	else {
 		assert(nextstate==S_ZOMB);
-		result = array_add(zombies, cur);
+		list_addtail(&zombies, &cur->t_listnode);
 	}
-	assert(result==0);
 
 	/*
-	 * Call the scheduler (must come *after* the array_adds)
+	 * Call the scheduler (must come *after* the list adds)
 	 */
 
 	next = scheduler();
 
 	/* update curthread */
 	curthread = next;
+
+	if (next != cur) {
+		/* Preemption comes from the clock interrupt */
+		scheduler_countswitch(cur, nextstate==S_READY && in_interrupt);
+	}
 	
 	/* 
 	 * Call the machine-dependent code that actually does the
@@ -497,6 +759,7 @@ thread_exit(void)
 
 	assert(numthreads>0);
 	numthreads--;
+	list_remove(&allthreads, &curthread->t_allnode);
 	mi_switch(S_ZOMB);
 
 	panic("Thread came back from the dead!\n");
@@ -510,10 +773,10 @@ thread_yield(void)
 {
 	int spl = splhigh();
 
-	/* Check sleepers just in case we get here after shutdown */
-	assert(sleepers != NULL);
-
-	mi_switch(S_READY);
+	/* Don't bother switching if there's nobody to switch to */
+	if (scheduler_hasready()) {
+		mi_switch(S_READY);
+	}
 	splx(spl);
 }
 
@@ -546,33 +809,98 @@ thread_sleep(const void *addr)
 void
 thread_wakeup(const void *addr)
 {
-	int i, result;
+	struct wchan *wc;
+	struct thread *t;
+	int result;
 	
 	// meant to be called with interrupts off
 	assert(curspl>0);
-	
-	// This is inefficient. Feel free to improve it.
-	
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
-		if (t->t_sleepaddr == addr) {
-			
-			// Remove from list
-			array_remove(sleepers, i);
-			
-			// must look at the same sleepers[i] again
-			i--;
-
-			/*
-			 * Because we preallocate during thread_fork,
-			 * this should never fail.
-			 */
-			result = make_runnable(t);
-			assert(result==0);
-		}
+
+	wc = wchan_find(addr);
+	if (wc == NULL) {
+		return;
+	}
+
+	/* The last thread out takes the channel, leaving it empty */
+	while ((t = list_head(&wc->wc_threads)) != NULL) {
+		wchan_remove(t);
+		result = make_runnable(t);
+		assert(result==0);
+	}
+}
+
+/*
+ * Wake up the thread that has been sleeping longest on "sleep address"
+ * ADDR, and return it. Returns NULL if nobody is sleeping on ADDR.
+ */
+struct thread *
+thread_wakeone(const void *addr)
+{
+	struct wchan *wc;
+	struct thread *t;
+	int result;
+
+	// meant to be called with interrupts off
+	assert(curspl>0);
+
+	wc = wchan_find(addr);
+	if (wc == NULL) {
+		return NULL;
+	}
+
+	t = list_head(&wc->wc_threads);
+	wchan_remove(t);
+	result = make_runnable(t);
+	assert(result==0);
+
+	return t;
+}
+
+/*
+ * Timer function for thread_sleep_timeout: wake the thread, unless
+ * something else got there first.
+ */
+static
+void
+thread_timeout(void *data)
+{
+	struct thread *t = data;
+	int result;
+
+	if (wchan_remove(t)) {
+		t->t_timedout = 1;
+		result = make_runnable(t);
+		assert(result==0);
 	}
 }
 
+/*
+ * Like thread_sleep, but give up after TICKS clock ticks. Returns 0 if
+ * woken by thread_wakeup or thread_wakeone, ETIMEDOUT if time ran out.
+ */
+int
+thread_sleep_timeout(const void *addr, u_int32_t ticks)
+{
+	struct timer tm;
+
+	// may not sleep in an interrupt handler
+	assert(in_interrupt==0);
+	assert(curspl>0);
+
+	if (ticks == 0) {
+		return ETIMEDOUT;
+	}
+
+	curthread->t_timedout = 0;
+	timer_init(&tm, thread_timeout, curthread);
+	timer_add(&tm, ticks);
+
+	thread_sleep(addr);
+
+	timer_cancel(&tm);
+	return curthread->t_timedout ? ETIMEDOUT : 0;
+}
+
 /*
  * Return nonzero if there are any threads who are sleeping on "sleep address"
  * ADDR. This is meant to be used only for diagnostic purposes.
@@ -580,18 +908,72 @@ thread_wakeup(const void *addr)
 int
 thread_hassleepers(const void *addr)
 {
-	int i;
-	
 	// meant to be called with interrupts off
 	assert(curspl>0);
-	
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
-		if (t->t_sleepaddr == addr) {
-			return 1;
+
+	return wchan_find(addr) != NULL;
+}
+
+/*
+ * Return the highest effective priority of the threads sleeping on
+ * "sleep address" ADDR, or -1 if nobody is.
+ */
+int
+thread_sleeperpriority(const void *addr)
+{
+	struct wchan *wc;
+	struct listnode *ln;
+	struct thread *t;
+	int pri = -1;
+
+	// meant to be called with interrupts off
+	assert(curspl>0);
+
+	wc = wchan_find(addr);
+	if (wc == NULL) {
+		return -1;
+	}
+
+	for (ln = list_first(&wc->wc_threads); ln != NULL;
+	     ln = list_next(&wc->wc_threads, ln)) {
+		t = ln->ln_self;
+		if (t->t_epriority > pri) {
+			pri = t->t_epriority;
 		}
 	}
-	return 0;
+	return pri;
+}
+
+/*
+ * Call FUNC on every live thread.
+ */
+void
+thread_foreach(void (*func)(struct thread *t, void *data), void *data)
+{
+	struct listnode *ln;
+
+	assert(curspl>0);
+
+	for (ln = list_first(&allthreads); ln != NULL;
+	     ln = list_next(&allthreads, ln)) {
+		func(ln->ln_self, data);
+	}
+}
+
+/*
+ * Set the priority of thread T.
+ */
+void
+thread_setpriority(struct thread *t, int priority)
+{
+	int spl;
+
+	assert(priority >= PRI_MIN && priority <= PRI_MAX);
+
+	spl = splhigh();
+	t->t_priority = priority;
+	lock_updatepriority(t);
+	splx(spl);
 }
 
 /*
@@ -0,0 +1,147 @@
+/*
+ * Kernel timers.
+ * See timer.h for more information.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <machine/spl.h>
+#include <thread.h>
+#include <timer.h>
+
+#define TIMER_WHEELBITS 8
+#define NTIMERSLOTS     (1 << TIMER_WHEELBITS)
+#define TIMERSLOT(t)    ((t) & (NTIMERSLOTS-1))
+
+/* Pending timers, by the slot their expiry tick falls in */
+static struct timer *wheel[NTIMERSLOTS];
+
+/* Ticks since boot */
+static volatile u_int32_t timer_ticks;
+
+/*
+ * List handling. Interrupts must be off.
+ */
+static
+void
+timer_link(struct timer **head, struct timer *tm)
+{
+	tm->tm_next = *head;
+	if (*head != NULL) {
+		(*head)->tm_prevp = &tm->tm_next;
+	}
+	tm->tm_prevp = head;
+	*head = tm;
+}
+
+static
+void
+timer_unlink(struct timer *tm)
+{
+	*tm->tm_prevp = tm->tm_next;
+	if (tm->tm_next != NULL) {
+		tm->tm_next->tm_prevp = tm->tm_prevp;
+	}
+	tm->tm_next = NULL;
+	tm->tm_prevp = NULL;
+}
+
+void
+timer_init(struct timer *tm, void (*func)(void *), void *data)
+{
+	tm->tm_next = NULL;
+	tm->tm_prevp = NULL;
+	tm->tm_expires = 0;
+	tm->tm_func = func;
+	tm->tm_data = data;
+}
+
+void
+timer_add(struct timer *tm, u_int32_t ticks)
+{
+	int spl;
+
+	assert(ticks > 0);
+
+	spl = splhigh();
+
+	assert(tm->tm_prevp == NULL);
+	tm->tm_expires = timer_ticks + ticks;
+	timer_link(&wheel[TIMERSLOT(tm->tm_expires)], tm);
+
+	splx(spl);
+}
+
+int
+timer_cancel(struct timer *tm)
+{
+	int spl, pending;
+
+	spl = splhigh();
+
+	pending = (tm->tm_prevp != NULL);
+	if (pending) {
+		timer_unlink(tm);
+	}
+
+	splx(spl);
+	return pending;
+}
+
+u_int32_t
+timer_now(void)
+{
+	return timer_ticks;
+}
+
+/*
+ * Advance the clock and fire whatever is due. Timers in this tick's
+ * slot that are due on a later turn of the wheel stay put.
+ *
+ * Due timers are moved to a list of their own before any is fired,
+ * so a timer function can add or cancel timers, including ones due
+ * this same tick, without upsetting the walk.
+ */
+void
+timer_tick(void)
+{
+	struct timer *tm, *next, *due;
+
+	assert(curspl>0);
+
+	timer_ticks++;
+
+	due = NULL;
+	for (tm = wheel[TIMERSLOT(timer_ticks)]; tm != NULL; tm = next) {
+		next = tm->tm_next;
+		if (tm->tm_expires == timer_ticks) {
+			timer_unlink(tm);
+			timer_link(&due, tm);
+		}
+	}
+
+	while (due != NULL) {
+		tm = due;
+		timer_unlink(tm);
+		tm->tm_func(tm->tm_data);
+	}
+}
+
+void
+timer_sleep(u_int32_t ticks)
+{
+	int spl, result;
+
+	if (ticks == 0) {
+		return;
+	}
+
+	spl = splhigh();
+
+	/* Nobody else knows this address, so only the timeout wakes us */
+	result = thread_sleep_timeout(&spl, ticks);
+	assert(result == ETIMEDOUT);
+
+	splx(spl);
+}
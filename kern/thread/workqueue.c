@@ -0,0 +1,347 @@
+/*
+ * Workqueues.
+ * See workqueue.h for more information.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <machine/spl.h>
+#include <thread.h>
+#include <list.h>
+#include <timer.h>
+#include <workqueue.h>
+
+/*
+ * Everything here is protected by turning interrupts off, which is
+ * what lets work be submitted from interrupt handlers. Idle workers
+ * sleep on the workqueue itself; flushers sleep on wq_nbusy, and
+ * workqueue_destroy on wq_nthreads.
+ */
+struct workqueue {
+	char *wq_name;
+	struct list wq_work;		/* queued work, oldest first */
+	int wq_nthreads;		/* workers still running */
+	int wq_nbusy;			/* workers running work just now */
+	int wq_ndelayed;		/* work waiting for its timer */
+	int wq_dying;			/* workers should exit when idle */
+
+	/* Statistics */
+	unsigned long wq_nsubmits;
+	unsigned long wq_nruns;
+	unsigned long wq_ncancels;
+	unsigned wq_maxqueued;
+
+	struct listnode wq_node;	/* on allqueues */
+};
+
+/* Number of workers in the general purpose queue */
+#define SYS_WQ_THREADS 2
+
+struct workqueue *sys_wq;
+
+/* All queues, for workqueue_printstats. */
+static struct list allqueues;
+
+/*
+ * Wake anyone flushing WQ if it has gone idle. Interrupts must be off.
+ */
+static
+void
+wq_checkidle(struct workqueue *wq)
+{
+	if (wq->wq_nbusy == 0 && list_isempty(&wq->wq_work)) {
+		thread_wakeup(&wq->wq_nbusy);
+	}
+}
+
+/*
+ * Put W on the back of its queue and get a worker onto it. Interrupts
+ * must be off.
+ */
+static
+void
+work_enqueue(struct work *w)
+{
+	struct workqueue *wq = w->wk_wq;
+
+	assert(curspl>0);
+
+	w->wk_state = WORK_QUEUED;
+	list_addtail(&wq->wq_work, &w->wk_node);
+	wq->wq_nsubmits++;
+	if (list_count(&wq->wq_work) > wq->wq_maxqueued) {
+		wq->wq_maxqueued = list_count(&wq->wq_work);
+	}
+
+	thread_wakeone(wq);
+}
+
+/*
+ * Timer function for workqueue_submit_delayed.
+ */
+static
+void
+work_timeout(void *data)
+{
+	struct work *w = data;
+
+	assert(w->wk_state == WORK_DELAYED);
+	w->wk_wq->wq_ndelayed--;
+	work_enqueue(w);
+}
+
+/*
+ * Worker thread. The work item is finished with as soon as it's taken
+ * off the queue, so its function is free to resubmit or free it.
+ */
+static
+void
+wq_worker(void *data1, unsigned long junk)
+{
+	struct workqueue *wq = data1;
+	struct work *w;
+	void (*func)(void *);
+	void *data;
+	int spl;
+
+	(void)junk;
+
+	spl = splhigh();
+	for (;;) {
+		while (list_isempty(&wq->wq_work) && !wq->wq_dying) {
+			thread_sleep(wq);
+		}
+
+		w = list_remhead(&wq->wq_work);
+		if (w == NULL) {
+			break;
+		}
+		w->wk_state = WORK_IDLE;
+		w->wk_wq = NULL;
+		func = w->wk_func;
+		data = w->wk_data;
+		wq->wq_nbusy++;
+
+		splx(spl);
+		func(data);
+		spl = splhigh();
+
+		wq->wq_nbusy--;
+		wq->wq_nruns++;
+		wq_checkidle(wq);
+	}
+
+	/* Last thing touching WQ; workqueue_destroy may free it after this */
+	wq->wq_nthreads--;
+	thread_wakeup(&wq->wq_nthreads);
+	splx(spl);
+}
+
+struct workqueue *
+workqueue_create(const char *name, int nthreads)
+{
+	struct workqueue *wq;
+	char tname[THREAD_NAMELEN];
+	int i, spl, result;
+
+	assert(nthreads > 0);
+
+	wq = kmalloc(sizeof(struct workqueue));
+	if (wq == NULL) {
+		return NULL;
+	}
+
+	wq->wq_name = kstrdup(name);
+	if (wq->wq_name == NULL) {
+		kfree(wq);
+		return NULL;
+	}
+
+	list_init(&wq->wq_work);
+	wq->wq_nthreads = 0;
+	wq->wq_nbusy = 0;
+	wq->wq_ndelayed = 0;
+	wq->wq_dying = 0;
+	wq->wq_nsubmits = 0;
+	wq->wq_nruns = 0;
+	wq->wq_ncancels = 0;
+	wq->wq_maxqueued = 0;
+	listnode_init(&wq->wq_node, wq);
+
+	spl = splhigh();
+	list_addtail(&allqueues, &wq->wq_node);
+	splx(spl);
+
+	for (i=0; i<nthreads; i++) {
+		snprintf(tname, sizeof(tname), "%s/%d", name, i);
+		result = thread_fork(tname, wq, i, wq_worker, NULL);
+		if (result) {
+			workqueue_destroy(wq);
+			return NULL;
+		}
+
+		spl = splhigh();
+		wq->wq_nthreads++;
+		splx(spl);
+	}
+
+	return wq;
+}
+
+void
+workqueue_destroy(struct workqueue *wq)
+{
+	int spl;
+
+	workqueue_flush(wq);
+
+	spl = splhigh();
+
+	if (wq->wq_ndelayed > 0) {
+		panic("workqueue_destroy: %s: %d delayed items outstanding\n",
+		      wq->wq_name, wq->wq_ndelayed);
+	}
+
+	wq->wq_dying = 1;
+	thread_wakeup(wq);
+	while (wq->wq_nthreads > 0) {
+		thread_sleep(&wq->wq_nthreads);
+	}
+
+	list_remove(&allqueues, &wq->wq_node);
+
+	splx(spl);
+
+	kfree(wq->wq_name);
+	kfree(wq);
+}
+
+void
+work_init(struct work *w, void (*func)(void *), void *data)
+{
+	listnode_init(&w->wk_node, w);
+	timer_init(&w->wk_timer, work_timeout, w);
+	w->wk_wq = NULL;
+	w->wk_state = WORK_IDLE;
+	w->wk_func = func;
+	w->wk_data = data;
+}
+
+int
+workqueue_submit(struct workqueue *wq, struct work *w)
+{
+	return workqueue_submit_delayed(wq, w, 0);
+}
+
+int
+workqueue_submit_delayed(struct workqueue *wq, struct work *w,
+			 u_int32_t ticks)
+{
+	int spl;
+
+	spl = splhigh();
+
+	if (w->wk_state != WORK_IDLE) {
+		splx(spl);
+		return EBUSY;
+	}
+	assert(!wq->wq_dying);
+
+	w->wk_wq = wq;
+	if (ticks == 0) {
+		work_enqueue(w);
+	}
+	else {
+		w->wk_state = WORK_DELAYED;
+		wq->wq_ndelayed++;
+		timer_add(&w->wk_timer, ticks);
+	}
+
+	splx(spl);
+	return 0;
+}
+
+int
+workqueue_cancel(struct work *w)
+{
+	struct workqueue *wq;
+	int spl;
+
+	spl = splhigh();
+
+	wq = w->wk_wq;
+	if (w->wk_state == WORK_DELAYED) {
+		/* Interrupts are off, so it can't be firing right now */
+		timer_cancel(&w->wk_timer);
+		wq->wq_ndelayed--;
+	}
+	else if (w->wk_state == WORK_QUEUED) {
+		list_remove(&wq->wq_work, &w->wk_node);
+		wq_checkidle(wq);
+	}
+	else {
+		splx(spl);
+		return 0;
+	}
+
+	w->wk_state = WORK_IDLE;
+	w->wk_wq = NULL;
+	wq->wq_ncancels++;
+
+	splx(spl);
+	return 1;
+}
+
+void
+workqueue_flush(struct workqueue *wq)
+{
+	int spl;
+
+	spl = splhigh();
+	while (wq->wq_nbusy > 0 || !list_isempty(&wq->wq_work)) {
+		thread_sleep(&wq->wq_nbusy);
+	}
+	splx(spl);
+}
+
+/*
+ * Start the general purpose queue.
+ */
+void
+workqueue_bootstrap(void)
+{
+	list_init(&allqueues);
+
+	sys_wq = workqueue_create("sys_wq", SYS_WQ_THREADS);
+	if (sys_wq == NULL) {
+		panic("workqueue_bootstrap: Out of memory\n");
+	}
+}
+
+void
+workqueue_printstats(void)
+{
+	struct listnode *ln;
+	struct workqueue *wq;
+
+	/* print the whole thing with interrupts off */
+	int spl = splhigh();
+
+	kprintf("Workqueues:\n");
+	kprintf("  %-12s %4s %4s %6s %7s %6s %10s %10s %7s\n",
+		"name", "thr", "busy", "queued", "delayed", "maxq",
+		"submits", "runs", "cancels");
+
+	for (ln = list_first(&allqueues); ln != NULL;
+	     ln = list_next(&allqueues, ln)) {
+		wq = ln->ln_self;
+		kprintf("  %-12s %4d %4d %6u %7d %6u %10lu %10lu %7lu\n",
+			wq->wq_name, wq->wq_nthreads, wq->wq_nbusy,
+			list_count(&wq->wq_work), wq->wq_ndelayed,
+			wq->wq_maxqueued, wq->wq_nsubmits, wq->wq_nruns,
+			wq->wq_ncancels);
+	}
+
+	splx(spl);
+}
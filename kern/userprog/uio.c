@@ -1,4 +1,6 @@
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/limits.h>
 #include <lib.h>
 #include <uio.h>
 #include <thread.h>
@@ -26,20 +28,27 @@ uiomove(void *ptr, size_t n, struct uio *uio)
 	}
 
 	while (n > 0 && uio->uio_resid > 0) {
-		iov = &uio->uio_iovec;
-		size = iov->iov_len;
-
-		if (size > n) {
-			size = n;
-		}
-
-		if (size==0) {
+		if (uio->uio_iovcnt == 0) {
 			/* 
 			 * This should only happen if you set uio_resid
 			 * incorrectly (to more than the total length of
 			 * buffers the uio points to). 
 			 */
-			panic("uiomove: size reached 0\n");
+			panic("uiomove: ran out of buffers\n");
+		}
+
+		iov = uio->uio_iov;
+		size = iov->iov_len;
+
+		if (size==0) {
+			/* This one's used up (or empty), on to the next */
+			uio->uio_iov++;
+			uio->uio_iovcnt--;
+			continue;
+		}
+
+		if (size > n) {
+			size = n;
 		}
 
 		switch (uio->uio_segflg) {
@@ -114,6 +123,8 @@ void
 mk_kuio(struct uio *uio, void *kbuf, size_t len, off_t pos, enum uio_rw rw)
 {
 	uio->uio_iovec.iov_kbase = kbuf;
+	uio->uio_iov = &uio->uio_iovec;
+	uio->uio_iovcnt = 1;
 	uio->uio_iovec.iov_len = len;
 	uio->uio_offset = pos;
 	uio->uio_resid = len;
@@ -121,3 +132,60 @@ mk_kuio(struct uio *uio, void *kbuf, size_t len, off_t pos, enum uio_rw rw)
 	uio->uio_rw = rw;
 	uio->uio_space = NULL;
 }
+
+/*
+ * Convenience function to cons up a uio for I/O on a user buffer.
+ */
+void
+mk_uuio(struct uio *uio, userptr_t ubuf, size_t len, off_t pos,
+	enum uio_rw rw)
+{
+	uio->uio_iovec.iov_ubase = ubuf;
+	uio->uio_iov = &uio->uio_iovec;
+	uio->uio_iovcnt = 1;
+	uio->uio_iovec.iov_len = len;
+	uio->uio_offset = pos;
+	uio->uio_resid = len;
+	uio->uio_segflg = UIO_USERSPACE;
+	uio->uio_rw = rw;
+	uio->uio_space = curthread->t_vmspace;
+}
+
+/*
+ * Convenience function to cons up a uio for I/O on several user
+ * buffers.
+ */
+int
+mk_uuiov(struct uio *uio, struct iovec *iov, const_userptr_t uiov,
+	 int iovcnt, off_t pos, enum uio_rw rw)
+{
+	size_t total;
+	int i, result;
+
+	if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+		return EINVAL;
+	}
+
+	result = copyin(uiov, iov, iovcnt * sizeof(struct iovec));
+	if (result) {
+		return result;
+	}
+
+	total = 0;
+	for (i=0; i<iovcnt; i++) {
+		if (total + iov[i].iov_len < total) {
+			return EINVAL;
+		}
+		total += iov[i].iov_len;
+	}
+
+	uio->uio_iov = iov;
+	uio->uio_iovcnt = iovcnt;
+	uio->uio_offset = pos;
+	uio->uio_resid = total;
+	uio->uio_segflg = UIO_USERSPACE;
+	uio->uio_rw = rw;
+	uio->uio_space = curthread->t_vmspace;
+
+	return 0;
+}
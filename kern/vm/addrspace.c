@@ -2,6 +2,8 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <array.h>
+#include <kmem.h>
+#include <machine/spl.h>
 #include <thread.h>
 #include <curthread.h>
 #include <addrspace.h>
@@ -10,6 +12,7 @@
 #include <vnode.h>
 #include <mmap.h>
 #include <pagetable.h>
+#include <swap.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
@@ -44,11 +47,24 @@
  *   those and do a memcpy, we should probably
  *   write a nice pagetable function to handle all of this */
 
+/* the per-process page records come from their own object cache, 
+ * made by the first as_create */
+static struct kmem_cache *page_cache;
+
 struct addrspace *
 as_create(void)
 {
+	struct addrspace *as;
+	int spl;
+
+	spl = splhigh();
+	if (page_cache==NULL)
+		page_cache = kmem_cache_create("page", sizeof(struct page), NULL);
+	splx(spl);
+	if (page_cache==NULL)
+		return NULL;
 
-	struct addrspace *as = kmalloc(sizeof(struct addrspace));
+	as = kmalloc(sizeof(struct addrspace));
 	if (as==NULL) {
 		return NULL;
 	}
@@ -75,6 +91,7 @@ as_copy(struct addrspace *old, struct addrspace **ret, pid_t pid)
 	int i;
 	int nindex, oindex;
 	paddr_t nf, of;
+	int result;
 
 	newas = as_create();
 	if (newas==NULL) {
@@ -83,12 +100,21 @@ as_copy(struct addrspace *old, struct addrspace **ret, pid_t pid)
 
 	for(i=0;i<array_getnum(old->pages);i++)
 	{
-		newpage = (struct page *) kmalloc(sizeof(struct page));
+		newpage = (struct page *) kmem_cache_alloc(page_cache);
 		if (newpage==NULL)
+		{
+			as_discard(newas, pid);
 			return ENOMEM;
+		}
 		page = (struct page *) array_getguy(old->pages, i);
 		memcpy(newpage, page, sizeof(struct page));
-		array_add(newas->pages, newpage);
+		result = array_add(newas->pages, newpage);
+		if (result)
+		{
+			kmem_cache_free(page_cache, newpage);
+			as_discard(newas, pid);
+			return result;
+		}
 
 		oindex = getindex(newpage->vaddr);
 		of = FRAME(oindex);
@@ -120,7 +146,7 @@ as_destroy(struct addrspace *as)
 	{
 		p = (struct page *) array_getguy(as->pages, i);
 		invalidatepage(p->vaddr);
-		kfree(p);
+		kmem_cache_free(page_cache, p);
 	}
 
 	invalidateswapentries(curthread->t_pid);
@@ -129,6 +155,23 @@ as_destroy(struct addrspace *as)
 	kfree(as);
 }
 
+/* frees an address space made for pid that pid never ran in, from
+ * outside pid, along with the frames and swap charged to pid */
+void
+as_discard(struct addrspace *as, pid_t pid)
+{
+	int i;
+
+	invalidateframes(pid);
+	invalidateswapentries(pid);
+
+	for(i=0;i<array_getnum(as->pages);i++)
+		kmem_cache_free(page_cache, array_getguy(as->pages, i));
+
+	array_destroy(as->pages);
+	kfree(as);
+}
+
 void
 as_activate(struct addrspace *as)
 {
@@ -175,7 +218,7 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 
 	for (curpage=0;curpage<npages;curpage++)
 	{
-		p = (struct page *) kmalloc(sizeof(struct page));
+		p = (struct page *) kmem_cache_alloc(page_cache);
 		if (p==NULL)
 			return ENOMEM;
 		p->vaddr = vaddr + curpage * PAGE_SIZE;
@@ -275,7 +318,7 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 
 	for(curpage=0;curpage<npages;curpage++)
 	{
-		p = (struct page *) kmalloc(sizeof(struct page));
+		p = (struct page *) kmem_cache_alloc(page_cache);
 		if (p==NULL)
 			return ENOMEM;
 
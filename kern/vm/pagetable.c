@@ -3,10 +3,12 @@
 #include <synch.h>
 #include <kern/unistd.h>
 #include <machine/vm.h>
+#include <machine/spl.h>
 #include <thread.h>
 #include <curthread.h>
 #include <mmap.h>
 #include <swap.h>
+#include <proc.h>
 #include <pagetable.h>
 
 struct vnode *randvnode;
@@ -79,6 +81,35 @@ pagetable_bootstrap(void)
 
 }
 
+/* pushes whatever user page occupies the frame at index out to swap so
+ * the frame can be reused, and charges the eviction to the page's owner.
+ * Must be called with pagetable_lock held */
+static
+void
+evictframe(int index)
+{
+	struct pte *oldpte;
+
+	oldpte = &pagetable[index];
+
+	/* if the page we're replacing wasn't valid
+	 * increase occupancy count, there's nothing to write out */
+	if (!(oldpte->control & VALID_B))
+	{
+		occupation_cnt++;
+		return;
+	}
+
+	swapout(oldpte->page,
+		oldpte->owner,
+		(void *) PADDR_TO_KVADDR(FRAME(index)),	
+		oldpte->control & R_B,
+		oldpte->control & W_B,
+		oldpte->control & X_B);
+
+	proc_memaccount(oldpte->owner, -1, 0);
+}
+
 /* define alloc_kpages (malloc) here for the time being */
 /* kernel pages are a special case. since they will never 
  * be asked to be resolve by mips there only real presence
@@ -96,7 +127,7 @@ alloc_kpages(int npages)
 	{
 		lock_acquire(pagetable_lock);
 		free = 0;
-		for(i=0;i<pagetable_size;i++)
+		for(i=0;i+npages<=pagetable_size;i++)
 		{
 			if (!PTE_VALID(pagetable[i]))
 			{
@@ -107,11 +138,19 @@ alloc_kpages(int npages)
 				}
 				if (j==npages)
 				{
+					/* claim the whole run, the later frames
+					 * marked so free_kpages finds them */
 					occupation_cnt += npages;
 					free = FRAME(i);
-					pagetable[i].page  = 0;
-					pagetable[i].owner = 0;
-					pagetable[i].control = VALID_B | REF_B | SUPER_B;
+					for(j=0;j<npages;j++)
+					{
+						pagetable[i+j].page  = 0;
+						pagetable[i+j].owner = 0;
+						pagetable[i+j].kdata = NULL;
+						pagetable[i+j].control = 
+							VALID_B | REF_B | SUPER_B |
+							(j ? CONT_B : 0);
+					}
 					break;
 				}
 			}
@@ -123,49 +162,110 @@ alloc_kpages(int npages)
 		free = ram_stealmem(npages);
 	}
 	
-	if (free==0)
+	/* eviction only ever frees up one frame */
+	if ((free==0) && (npages==1))
 	{
 		lock_acquire(pagetable_lock);
 
-		index = pickreplacement();
-		/* if the page we're replacing wasn't valid
-		 * increase occupancy count */
-		if (!(pagetable[index].control & VALID_B))
-			occupation_cnt++;
-
-		oldpte = (struct pte *) &pagetable[index];
-
-		swapout(oldpte->page,
-			oldpte->owner,
-			(void *) PADDR_TO_KVADDR(FRAME(index)),	
-			oldpte->control & R_B,
-			oldpte->control & W_B,
-			oldpte->control & X_B);
+		/* kernel pages aren't charged to anyone */
+		index = pickreplacement(0);
+		evictframe(index);
 
-		/* only guaranteed to be one page */ 
 		free = FRAME(index);
 
+		oldpte = (struct pte *) &pagetable[index];
 		oldpte->page = 0;
 		oldpte->owner = 0;
-		oldpte->control |= VALID_B | REF_B | SUPER_B;
+		oldpte->kdata = NULL;
+		oldpte->control = VALID_B | REF_B | SUPER_B;
 
 		lock_release(pagetable_lock);
 	}
+
+	if (free==0)
+		return 0;
+
 	return PADDR_TO_KVADDR(free);
 }
 
-/* for now we just invalidate one page. This won't work if more than one
- * page was originally allocated */
+/* frees the frame at page and any later frames of the same
+ * allocation. Memory stolen before the pagetable existed is never
+ * given back */
 void
 free_kpages(vaddr_t page)
 {
+	u_int32_t i;
+	int spl;
+
 	if (pagetable_initialized)
 	{
-		pagetable[INDEX(KVADDR_TO_PADDR(page))].control &= ~(VALID_B | SUPER_B);
-		occupation_cnt--;
+		i = INDEX(KVADDR_TO_PADDR(page));
+		if (KVADDR_TO_PADDR(page) < bframe || i >= pagetable_size)
+			return;
+
+		/* called from kfree, perhaps with pagetable_lock held or
+		 * interrupts off, so just turn interrupts off */
+		spl = splhigh();
+		do
+		{
+			pagetable[i].control &= ~(VALID_B | SUPER_B | CONT_B);
+			pagetable[i].kdata = NULL;
+			occupation_cnt--;
+			i++;
+		} while ((i < pagetable_size) && (pagetable[i].control & CONT_B));
+		splx(spl);
 	}
 }
 
+/* returns the pte of the kernel frame holding kpage, or NULL if the
+ * frame isn't one the pagetable handed out to the kernel */
+static
+struct pte *
+getkpte(vaddr_t kpage)
+{
+	paddr_t paddr;
+	struct pte *p;
+
+	if (!pagetable_initialized)
+		return NULL;
+
+	paddr = KVADDR_TO_PADDR(kpage & PAGE_FRAME);
+	if ((paddr < bframe) || (INDEX(paddr) >= pagetable_size))
+		return NULL;
+
+	p = &pagetable[INDEX(paddr)];
+	if (!(p->control & VALID_B) || !(p->control & SUPER_B))
+		return NULL;
+
+	return p;
+}
+
+/* kernel frames are never evicted, so their kdata needs no locking */
+int
+setkframedata(vaddr_t kpage, void *data)
+{
+	struct pte *p;
+
+	p = getkpte(kpage);
+	if (p==NULL)
+		return -1;
+
+	p->kdata = data;
+	return 0;
+}
+
+void *
+getkframedata(vaddr_t kpage)
+{
+	struct pte *p;
+
+	p = getkpte(kpage);
+	if (p==NULL)
+		return NULL;
+
+	return p->kdata;
+}
+
 int
 addpage(vaddr_t page, pid_t pid, int read, int write, int execute, const void *content)
 {
@@ -181,7 +281,8 @@ addpage(vaddr_t page, pid_t pid, int read, int write, int execute, const void *c
 	cur = &pagetable[index];
 
 
-	if (occupation_cnt==pagetable_size)
+	/* a process at its resident-set cap doesn't get another frame */
+	if ((occupation_cnt==pagetable_size) || proc_atrsslimit(pid))
 	{
 		/* stash in virtual memory */
 		swapout(page, pid, content, read, write, execute);
@@ -220,6 +321,7 @@ addpage(vaddr_t page, pid_t pid, int read, int write, int execute, const void *c
 	}
 
 	occupation_cnt++;
+	proc_memaccount(pid, 1, 0);
 
 	lock_release(pagetable_lock);
 	return index;
@@ -237,19 +339,43 @@ invalidatepage(vaddr_t page)
 	{
 		return;	
 	}
-	occupation_cnt--;
 	lock_acquire(pagetable_lock);
+	occupation_cnt--;
 	pagetable[index].control &= ~(VALID_B | SUPER_B);
+	/* may be another process's frame, charge whoever held it */
+	proc_memaccount(pagetable[index].owner, -1, 0);
 
 	lock_release(pagetable_lock);
 }
 
+void
+invalidateframes(pid_t pid)
+{
+	u_int32_t i;
+	int n;
+
+	n = 0;
+	lock_acquire(pagetable_lock);
+	for(i=0;i<pagetable_size;i++)
+	{
+		if ((pagetable[i].owner==pid) && PTE_VALID(pagetable[i]) &&
+		    !(pagetable[i].control & SUPER_B))
+		{
+			pagetable[i].control &= ~VALID_B;
+			occupation_cnt--;
+			n++;
+		}
+	}
+	proc_memaccount(pid, -n, 0);
+	lock_release(pagetable_lock);
+}
+
 struct pte *
 getpte(vaddr_t page)
 {
-	struct pte *oldpte;
 	int rindex;
 	int index;
+	int result;
 
 	index = getindex(page);
 	if (index==-1)
@@ -261,23 +387,18 @@ getpte(vaddr_t page)
 		/* swap in page if found */
 		lock_acquire(pagetable_lock);
 
-		rindex = pickreplacement(); // REPLACEMENT POLICY GOES HERE
-
-		/* if the page we're replacing wasn't valid */
-		if (!(pagetable[rindex].control & VALID_B))
-			occupation_cnt++;
-
-		oldpte = (struct pte *) &pagetable[rindex];	
-
-		swapout(oldpte->page, 
-			oldpte->owner,
-			PADDR_TO_KVADDR(FRAME(rindex)),
-			oldpte->control & R_B,
-			oldpte->control & W_B,
-			oldpte->control & X_B);
+		rindex = pickreplacement(curthread->t_pid);
+		evictframe(rindex);
 
 		/* handles all memory transfer and sets up new pte */
-		swapin(rindex, page, curthread->t_pid);
+		result = swapin(rindex, page, curthread->t_pid);
+		if (result)
+		{
+			/* the emptied frame was counted as occupied */
+			occupation_cnt--;
+			lock_release(pagetable_lock);
+			return NULL;
+		}
 
 		/* append the replacement page to the proper hash chain */
 		//appendtochain(rindex, hash(page, curthread->t_pid));
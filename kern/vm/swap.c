@@ -8,6 +8,7 @@
 #include <vm.h>
 #include <uio.h>
 #include <pagetable.h>
+#include <proc.h>
 #include <swap.h>
 
 int swapsize;
@@ -61,13 +62,21 @@ void
 invalidateswapentries(pid_t pid)
 {
 	int i;
+	int n;
 
+	n = 0;
 	lock_acquire(swapped_lock);
 	for(i=0;i<swapsize;i++)
 		if (swapped[i].owner==pid)
+		{
+			if (swapped[i].valid)
+				n++;
 			swapped[i].valid = 0;
+		}
 
 	lock_release(swapped_lock);
+
+	proc_memaccount(pid, 0, -n);
 }
 
 int
@@ -129,6 +138,8 @@ swapout(vaddr_t page, pid_t pid, const void *content, int read, int write, int e
 		swapped[swap_index].perms |= X_B;
 
 	lock_release(swapped_lock);
+
+	proc_memaccount(pid, 0, 1);
 	return 0;
 }
 
@@ -174,19 +185,89 @@ swapin(int index, vaddr_t page, pid_t pid)
 			swap_index * PAGE_SIZE, UIO_READ);
 
 	result = VOP_READ(swap, &ku);
-
-	lock_release(swapped_lock);
 	if (result)
 	{
+		/* the page is still only in swap */
+		rpte->control &= ~VALID_B;
+		swap_page->valid = 1;
+		lock_release(swapped_lock);
 		return -result;
 	}
 
+	lock_release(swapped_lock);
+
+	proc_memaccount(pid, 1, -1);
+
 	return 0;
 }
 
+/* frame filters for clocksweep */
+static
+int
+ownedby(struct pte *p, pid_t pid)
+{
+	return p->owner==pid;
+}
+
+static
+int
+ownerover(struct pte *p, pid_t pid)
+{
+	(void)pid;
+	return proc_overrsslimit(p->owner);
+}
+
+/* runs the clock hand over the user frames accepted by match, clearing
+ * reference bits as it goes, and stops on the first unreferenced one.
+ * Two sweeps are enough since the first clears every reference bit.
+ * Returns pagetable_size if match accepted no frame */
+static
 unsigned int
-pickreplacement()
+clocksweep(int (*match)(struct pte *, pid_t), pid_t pid)
 {
+	struct pte *p;
+	unsigned int i;
+
+	for (i=0;i<2*pagetable_size;i++)
+	{
+		p = &pagetable[clock_hand];
+		clock_hand = (clock_hand + 1) % pagetable_size;
+
+		if (!(p->control & VALID_B) || (p->control & SUPER_B))
+			continue;
+		if (!match(p, pid))
+			continue;
+
+		if (!(p->control & REF_B))
+			return p - pagetable;
+
+		p->control &= ~REF_B;
+	}
+
+	return pagetable_size;
+}
+
+unsigned int
+pickreplacement(pid_t pid)
+{
+	unsigned int victim;
+
+	/* a process at its resident-set cap pages against itself */
+	if (proc_atrsslimit(pid))
+	{
+		victim = clocksweep(ownedby, pid);
+		if (victim!=pagetable_size)
+			return victim;
+	}
+
+	/* otherwise take from whoever is over their cap first */
+	if (proc_overrsscount() > 0)
+	{
+		victim = clocksweep(ownerover, pid);
+		if (victim!=pagetable_size)
+			return victim;
+	}
+
 	while ((pagetable[clock_hand].control & VALID_B) 
 			&& (pagetable[clock_hand].control & REF_B))
 	{